@@ -1,71 +1,219 @@
-#include <SDL2/SDL_audio.h>
+#pragma once
+#include <deque>
+
+#include "types.hpp"
+#include "Blip.hpp"
+
+#define SAMPLE_RATE 48000 // default output rate
+#define AUDIO_BLOCK 512   // largest block handed to a sink, in frames
+// AudioEvent address of a frame sequencer step, not a register
+#define AUDIO_SEQUENCER 0x0000
 
 struct Channel{
     bool active{false};
-    float phase{0.0f};
-    float duty{0.0f};
+    uint8_t duty{0};
     uint8_t direction{0};
+    // padding spelled out, save states copy the struct as it is
+    uint8_t reserved0{0};
 
     uint16_t current_F{0};
     uint16_t lfsr{0};
-    
-    int sweep_counter{0};
+
+    // cycles until the next waveform step, and the duty/wave position
+    int timer{0};
+    uint8_t position{0};
+
     uint8_t sweep_timer{0};
-    
-    int envelope_counter{0};
+
     uint8_t envelope_volume{0};
     uint8_t envelope_period{0};
+    uint8_t envelope_timer{0};
+    uint8_t reserved1[3]{};
+
+    int length_timer{0};
+    bool length_enabled{false};
+    uint8_t reserved2[3]{};
 
-    int length_counter{0};
-    uint8_t length_timer{0};
+    // amplitude last added to the left and right buffers
+    int left{0};
+    int right{0};
 };
 
-class MemoryMaster;
-class APU{
+// Receives interleaved stereo samples rendered against emulated time
+class AudioSink{
 public:
-    uint8_t NR52;
-    
-    uint8_t NR10;
-    uint8_t NR11;
-    uint8_t NR12;
-    uint8_t NR13;
-    uint8_t NR14;
-
-    uint8_t NR21;
-    uint8_t NR22;
-    uint8_t NR23;
-    uint8_t NR24;
-
-    uint8_t NR30;
-    uint8_t NR31;
-    uint8_t NR32;
-    uint8_t NR33;
-    uint8_t NR34;
-    uint8_t NR41;
-    uint8_t NR42;
-    uint8_t NR43;
-    uint8_t NR44;
-    uint8_t NR50;
-    uint8_t NR51;
-
-    uint8_t wave_ram[16];
-    SDL_AudioSpec spec;
-    SDL_AudioDeviceID device;
+    virtual ~AudioSink() = default;
+    virtual void write(const int16_t* samples, int count) = 0;
+    // Resampling ratio wanted for the next block, a sink playing in real
+    // time nudges it to keep its buffer level steady
+    virtual double rate() { return 1.0; }
+};
+
+// Register write stamped with the emulated cycle it happened at
+struct AudioEvent{
+    uint64_t time;
+    uint16_t addr;
+    uint8_t data;
+};
+
+// Channel state as heard, only touched by whoever pulls samples. It
+// follows the registers by replaying AudioEvents in order. Channel timers
+// run in emulated cycles and only amplitude changes reach the blip
+// buffers, so the cost follows the number of transitions.
+class AudioRenderer{
+    uint8_t NR10{0};
+    uint8_t NR12{0};
+    uint8_t NR22{0};
+    uint8_t NR30{0};
+    uint8_t NR42{0};
+    uint8_t NR43{0};
+    uint8_t NR50{0};
+    uint8_t NR51{0};
+    uint8_t NR52{0};
+    uint8_t wave_ram[16]{};
+    // channels mixed into the output, bit n for channel n+1
+    uint8_t mask{0x0F};
+    // left/right output of each channel at every level, follows NR50/NR51
+    int16_t gains[4][2][16]{};
+
+    BlipBuffer blipLeft;
+    BlipBuffer blipRight;
+    uint64_t time{0};
+    uint64_t frameStart{0};
+    uint8_t sequencerStep{0};
 
+    Channel& channel(int index);
+    int period(int index);
+    int level(int index);
+    void updateGains();
+    void mix(int index, uint64_t at);
+    void clockChannel(int index, uint64_t until);
+    void clockSequencer();
+    void trigger(int index, uint8_t data);
+
+    void updateEvelope(Channel& ch);
+    void updateLenght(Channel& ch);
+    void updateSweep(Channel& ch);
+public:
     Channel SweepChannel;
     Channel BahChannel;
     Channel WaveChannel;
     Channel NoiseChannel;
 
-    float leftVolume{0};
-    float rightVolume{0};
+    AudioRenderer();
+    void setSampleRate(double rate);
+    void setMask(uint8_t channels);
+    // Time at which frames more samples are complete
+    uint64_t timeFor(int frames);
+    void run(uint64_t until);
+    void apply(uint16_t addr, uint8_t data);
+    // Interleaved stereo, at most BLIP_CAPACITY frames at a time
+    int read(int16_t* buffer, int frames);
+    // Starts over silent at cycle at
+    void restart(uint64_t at);
+
+    void saveState(StateWriter& state);
+    bool loadState(StateReader& state);
+    // false if waveform positions or the pending samples are out of range,
+    // or, when timed, running on to cycle until would overfill the buffers
+    bool checkState(StateReader& state, uint64_t until, bool timed);
+};
+
+// Where the sound goes, picked at startup. Without a sink (null) nothing
+// is synthesized, only the register side runs.
+enum AudioBackend{
+    AUDIO_SDL,
+    AUDIO_FILE,
+    AUDIO_NULL
+};
+bool parseAudioBackend(const char* name, AudioBackend& backend);
+
+class Scheduler;
+class Timer;
+class APU{
+    AudioSink* sink{nullptr};
+    Scheduler* scheduler{nullptr};
+    // emulated time at which the next block of samples is complete
+    uint64_t nextBlock{0};
+    int sampleRate{SAMPLE_RATE};
+    int block{AUDIO_BLOCK};
+    double ratio{1.0};
+
+    // written and replayed on the emulation thread, grows as needed so
+    // no write is lost
+    std::deque<AudioEvent> events;
+    AudioRenderer renderer;
+    // one renderer per channel for stems, following the same events
+    AudioRenderer* stems[4]{};
+    AudioSink* stemSinks[4]{};
+
+    // What the CPU can see of the channels: NR52's status bits and the
+    // length counters. Kept without any sink, the sequencer steps due are
+    // read off DIV and applied when a register is touched.
+    uint8_t status{0};
+    int lengths[4]{};
+    uint8_t sequencerStep{0};
+    uint32_t stepsSeen{0}; // sequencer edges since DIV was reset, applied already
+    Timer* timer{nullptr};
+    void catchUp();
+    void step(uint32_t steps);
+    void trigger(int index, uint8_t data);
+    void scheduleBlock();
+    void replay(uint64_t until);
+public:
+    uint8_t NR52{0};
     
-    APU();
+    uint8_t NR10{0};
+    uint8_t NR11{0};
+    uint8_t NR12{0};
+    uint8_t NR13{0};
+    uint8_t NR14{0};
+
+    uint8_t NR21{0};
+    uint8_t NR22{0};
+    uint8_t NR23{0};
+    uint8_t NR24{0};
+
+    uint8_t NR30{0};
+    uint8_t NR31{0};
+    uint8_t NR32{0};
+    uint8_t NR33{0};
+    uint8_t NR34{0};
+    uint8_t NR41{0};
+    uint8_t NR42{0};
+    uint8_t NR43{0};
+    uint8_t NR44{0};
+    uint8_t NR50{0};
+    uint8_t NR51{0};
+
+    uint8_t wave_ram[16]{};
+
     ~APU();
-    void updateEvelope(Channel& ch);
-    void updateLenght(Channel& ch);
-    void updateSweep(Channel& ch);
+    void render(int16_t* buffer, int samples);
+    void setSink(AudioSink* output);
+    AudioSink* getSink();
+    // Channel 0-3 alone to output, alongside the sink. Set up before
+    // emulation starts, nullptr removes it.
+    void setStem(int channel, AudioSink* output);
+    // Output rate and frames per block (up to AUDIO_BLOCK), smaller
+    // blocks reach the sink sooner
+    void setOutput(int rate, int frames);
+    void setScheduler(Scheduler* master);
+    void setTimer(Timer* master);
+    // EVENT_AUDIO is due, hands the finished block to the sink
+    void update();
+    // Falling edge of the DIV bit driving the frame sequencer at cycle at,
+    // for the sound only, the registers catch up from DIV
+    void sequencerTick(uint64_t at);
+    // DIV is about to be reset, with a falling edge if edge is set
+    void divReset(bool edge);
     
     bool write(uint16_t addr, uint8_t data);
     bool read(uint16_t addr, uint8_t& data);
+
+    // The renderer is brought up to now first, so samples continue
+    // where they left off after a load. Stems restart from the mix.
+    void saveState(StateWriter& state);
+    bool loadState(StateReader& state);
+    bool checkState(StateReader& state, uint64_t now);
 };
\ No newline at end of file
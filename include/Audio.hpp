@@ -0,0 +1,52 @@
+#pragma once
+#include <SDL2/SDL_audio.h>
+
+#include "AudioRing.hpp"
+#include "Stretch.hpp"
+#include "Screen.hpp"
+
+struct AudioConfig{
+    int sampleRate{SAMPLE_RATE};
+    int bufferSize{2048};  // device buffer, in sample frames
+    int latency{0};        // ms kept queued ahead, 0 picks two device buffers
+    bool queue{false};     // SDL_QueueAudio instead of the callback
+    bool stretch{false};   // away from real time: time-stretched, not muted
+};
+
+// SDL playback device. Samples come pre-rendered from the emulation
+// thread, either through an AudioRing drained by the callback or queued
+// with SDL_QueueAudio. Synced to video, the resampling ratio follows the
+// queued amount, synced to audio, writes block and pace the emulation.
+class AudioDevice : public AudioSink{
+    APU& apu;
+    SDL_AudioSpec spec;
+    SDL_AudioDeviceID device;
+    SyncMode sync;
+    bool queue;
+    AudioRing ring;
+    bool started{false};
+    double speed{1.0};
+    bool stretch;
+    TimeStretch stretcher;
+    std::vector<int16_t> stretched;
+public:
+    // underruns of the queue path, the callback counts them in ring
+    uint32_t underruns{0};
+
+    AudioDevice(APU& apu, SyncMode sync, const AudioConfig& config);
+    ~AudioDevice();
+
+    void write(const int16_t* samples, int count) override;
+    double rate() override;
+    // Emulation speed, 0 for unlimited. Away from 1 the sound is
+    // stretched to it when asked for and possible, muted otherwise.
+    void setSpeed(double speed);
+
+    // metrics
+    int fill();
+    int target();
+    double ratio();
+    uint32_t underrunCount();
+    // frames dropped on a full ring, queueing never drops any
+    uint32_t overrunCount();
+};
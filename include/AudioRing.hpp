@@ -0,0 +1,35 @@
+#pragma once
+#include <atomic>
+
+#include "APU.hpp"
+#include "RingBuffer.hpp"
+
+#define MAX_RATE_DELTA 0.005  // largest resampling correction, 0.5%
+
+// Ratio that pulls a buffer at fill back toward target
+double rateControl(int fill, int target);
+
+// Pre-rendered samples between the emulation thread and a real-time
+// consumer. Non-blocking, rate() follows the fill level so it stays near
+// target; blocking, write() waits while the fill is above target and the
+// consumer paces the producer. Sized for target plus two consumer pulls.
+class AudioRing : public AudioSink{
+    RingBuffer<int16_t> ring;
+    bool blocking;
+public:
+    // metrics: level kept in the ring, the current ratio, the times the
+    // consumer found it short and the frames dropped when it was full
+    int target;
+    double ratio{1.0};
+    std::atomic<uint32_t> underruns{0};
+    std::atomic<uint32_t> overruns{0};
+
+    // pull is the most the consumer takes at once, in int16 values
+    AudioRing(int target, int pull, bool blocking);
+
+    void write(const int16_t* samples, int count) override;
+    double rate() override;
+    // consumer side, pads with silence when short
+    void pull(int16_t* out, int count);
+    int fill();
+};
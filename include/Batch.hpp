@@ -0,0 +1,28 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// One headless session of a batch. Every line of a job list is a rom and
+// a frame count followed by optional outputs, e.g.
+//   game.gb 600 input=walk.txt hashes=walk.log frame=walk.ppm audio=walk.wav
+// golden=file checks the frame hashes like gbc-headless --golden does.
+// '#' starts a comment.
+struct BatchJob{
+    std::string rom;
+    uint32_t frames{0};
+    std::string input;
+    std::string hashes;
+    std::string golden;
+    std::string frame;
+    std::string audio;
+
+    // filled in by the run
+    uint32_t ran{0}; // frames actually run
+    double seconds{0};
+    bool failed{false};
+    bool mismatch{false};
+};
+
+bool readJobs(const char* filename, std::vector<BatchJob>& jobs);
+int runBatch(int args, char* argv[]);
@@ -0,0 +1,41 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "State.hpp"
+
+#define BLIP_TAPS 16
+#define BLIP_PHASES 32
+#define BLIP_CAPACITY 4096
+
+// Band-limited synthesis buffer. Amplitude steps are added at clock times
+// within the current frame as band-limited impulses, read() integrates
+// them into samples. The clock to sample rate conversion happens here, so
+// nothing is done per sample until the samples are read.
+class BlipBuffer{
+    uint64_t factor{0};   // samples per clock, 32.32 fixed point
+    uint64_t offset{0};   // frame start relative to buffer[0], 32.32
+    int32_t integrator{0};
+    std::vector<int32_t> buffer;
+public:
+    BlipBuffer();
+
+    void setRates(double clockRate, double sampleRate);
+    void clear();
+
+    // time is in clocks since the last endFrame()
+    void addDelta(uint32_t time, int delta);
+    // Clocks to run from the frame start before samples are available
+    uint32_t clocksNeeded(int samples);
+    void endFrame(uint32_t time);
+
+    int samplesAvail();
+    // Writes count samples every stride values of out, returns how many
+    int read(int16_t* out, int count, int stride);
+
+    // Pending samples, not the rates
+    void saveState(StateWriter& state);
+    bool loadState(StateReader& state);
+    // false unless clocks more from the saved frame start still fit
+    bool checkState(StateReader& state, uint64_t clocks);
+};
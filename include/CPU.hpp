@@ -1,4 +1,6 @@
+#pragma once
 #include "types.hpp"
+#include "State.hpp"
 
 enum Flags {
     car = 0x10,
@@ -9,6 +11,7 @@ enum Flags {
 class MemoryMaster;
 class CPU{
     MemoryMaster& MEM;
+    InterruptState& IS;
 
     bool halt{false};
     bool ime{false};
@@ -111,4 +114,9 @@ public:
     CPU(MemoryMaster& master);
     void init();
     int step();
+    // Stopped by HALT with nothing to wake it yet
+    bool sleeping();
+
+    void saveState(StateWriter& state);
+    bool loadState(StateReader& state);
 };
@@ -0,0 +1,15 @@
+#pragma once
+#include <cstdint>
+
+enum ColorMode{
+    COLOR_RAW = 0,   // plain 5 to 8 bit expansion
+    COLOR_LCD = 1,   // GBC LCD color mixing, less saturated
+    COLOR_GAMMA = 2  // LCD mixing done in linear light
+};
+
+// BGR555 -> RGBA8888 for every CGB color, built once per mode on first use
+const uint32_t* colorTable(ColorMode mode);
+// RGBA8888 of the four DMG shades
+const uint32_t* shadeTable(ColorMode mode);
+
+bool parseColorMode(const char* name, ColorMode& mode);
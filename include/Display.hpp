@@ -1,30 +1,61 @@
 #pragma once
 
 #include <SDL2/SDL.h>
-#include "Joypad.hpp"
+#include "Screen.hpp"
+#include "Scaler.hpp"
 
 class MemoryMaster;
-class Window{
+class AudioDevice;
+class Window : public Screen{
     SDL_Window* window;
     SDL_Renderer* renderer;
-    SDL_Texture* texture;
-    uint32_t* display;
+    // Double-buffered streaming textures: the PPU writes straight into
+    // the locked back texture while the front one is presented.
+    SDL_Texture* textures[2];
+    uint8_t back{0};
+    bool locked{false};
+    uint32_t* scratch;
     SDL_Rect dst;
+    // Optional CPU upscaler: the PPU then draws into scratch and show()
+    // scales it into the larger back texture.
+    Upscaler* scaler{nullptr};
 
-    bool shouldClose;
+    bool shouldClose{false};
+    SyncMode sync{SYNC_VIDEO};
+    Uint64 nextFrame{0};
+
+    // Emulation speed, 1 is real time and 0 unlimited, turboSpeed while
+    // turbo is held. Faster than real time only the newest frame is
+    // presented, once per display refresh.
+    double speed{1.0};
+    double turboSpeed{0};
+    bool turbo{false};
+    double paced{1.0};
+    Uint64 refresh;
+    Uint64 nextPresent{0};
+    Uint64 lastShow{0};
+    AudioDevice* audio{nullptr};
+    // speed achieved, measured every half second
+    Uint64 measureStart{0};
+    int measureFrames{0};
+    double achieved{1.0};
 
     void resize(int newW, int newH);
+    void stepSpeed(int direction);
+    void drawSpeed();
 public:
-    Joypad joypad;
-    
     Window(unsigned int width, unsigned int height, const char* name);
     ~Window();
-    void poolEvents();
+    void poolEvents() override;
     bool poolFile(MemoryMaster& master);
 
-    void drawLine(uint8_t* lines, uint8_t y);
-    void setPixel(uint8_t x, int dy, uint32_t color);
-    
-    void show();
-    bool isOpen();
+    void setFilter(ScaleFilter filter, int factor, int threads = 0);
+    void setSync(SyncMode mode);
+    void setSpeed(double speed, double turboSpeed);
+    // told the speed, to mute or stretch the sound
+    void setAudio(AudioDevice* device);
+
+    uint32_t* lockFrame(int& pitch) override;
+    void show() override;
+    bool isOpen() override;
 };
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "CPU.hpp"
+#include "PPU.hpp"
+#include "APU.hpp"
+#include "MEM.hpp"
+#include "Timer.hpp"
+#include "Serial.hpp"
+#include "Screen.hpp"
+#include "Scheduler.hpp"
+
+class Rewind;
+class RunAhead;
+class GameBoy{
+    void dispatch();
+    void saveSections(StateWriter& state);
+public:
+    Scheduler scheduler;
+    Screen& context;
+    MemoryMaster MEM;
+    CPU GB;
+    PPU GC;
+    APU AP;
+    Timer timer;
+    Serial serial;
+    // Optional, start() then records into it and plays it back while
+    // the screen is rewinding
+    Rewind* rewind{nullptr};
+    // Optional, start() then runs and shows frames through it
+    RunAhead* runAhead{nullptr};
+
+    GameBoy(Screen& screen);
+
+    void init();
+    void step();
+    void runFrame();
+    void start();
+
+    // Save states, see State.hpp. stateSize() is fixed for a cartridge.
+    size_t stateSize();
+    // false if buffer is smaller than stateSize()
+    bool saveState(uint8_t* buffer, size_t size);
+    // false, with the machine untouched, if the state is damaged, from
+    // another version or from another cartridge
+    bool loadState(const uint8_t* buffer, size_t size);
+};
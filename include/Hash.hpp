@@ -0,0 +1,6 @@
+#pragma once
+#include <cstdint>
+
+// xxHash3-style 64 bit hash of a SCW x SCH RGBA frame, pitch in pixels.
+// SSE2 and scalar paths give the same value.
+uint64_t hashFrame(const uint32_t* pixels, int pitch);
@@ -0,0 +1,48 @@
+#pragma once
+#include <fstream>
+#include <utility>
+#include <vector>
+
+#include "Screen.hpp"
+#include "APU.hpp"
+
+// Screen without a window or SDL: frames land in a plain RGBA buffer
+// (and optionally a palette index buffer through PPU::setIndexBuffer),
+// nothing is paced.
+class Framebuffer : public Screen{
+public:
+    uint32_t pixels[SCW*SCH]{};
+    uint8_t indices[SCW*SCH]{};
+
+    uint32_t* lockFrame(int& pitch) override;
+    void show() override;
+    void poolEvents() override;
+    bool isOpen() override;
+};
+
+// Keeps every rendered sample in memory
+class SampleBuffer : public AudioSink{
+public:
+    std::vector<int16_t> samples;
+
+    void write(const int16_t* data, int count) override;
+};
+
+// Streams samples to disk as they are rendered: a 16 bit stereo WAV when
+// the name ends in .wav, raw little-endian PCM otherwise
+class AudioFile : public AudioSink{
+    std::ofstream file;
+    bool wav{false};
+    int rate{SAMPLE_RATE};
+    uint32_t bytes{0};
+public:
+    ~AudioFile();
+    bool open(const char* filename, int sampleRate);
+    // patches the WAV header sizes
+    void close();
+    void write(const int16_t* data, int count) override;
+};
+
+bool writePPM(const char* filename, const uint32_t* pixels, int pitch);
+// Golden files use the hash log format: "frame hash" per line
+bool readHashes(const char* filename, std::vector<std::pair<uint32_t, uint64_t>>& hashes);
@@ -0,0 +1,5 @@
+#pragma once
+
+// gbc-headless command line: plain runs, golden checks and the benches.
+// Built into the executables, not into libbyteboy.
+int runHeadless(int args, char* argv[]);
@@ -1,14 +1,21 @@
 #pragma once
 #include "types.hpp"
+#include "State.hpp"
 
 class Joypad{
     uint8_t Joypad{0xFF};
+    InterruptState* IS{nullptr};
 public:
     uint8_t directions{0xF};
     uint8_t buttons{0xF};
     
+    void setInterrupts(InterruptState* master);
     void update();
 
     bool write(uint16_t addr, uint8_t data);
     bool read(uint16_t addr, uint8_t& data);
+
+    // Only the register, held buttons belong to whoever is playing
+    void saveState(StateWriter& state);
+    bool loadState(StateReader& state);
 };
@@ -0,0 +1,74 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include "RingBuffer.hpp"
+
+#define LINK_QUEUE 1024
+
+enum LinkMessageType{
+    LINK_TIME,  // how far the sender has run
+    LINK_DATA,  // a byte clocked out by the sender's internal clock
+    LINK_REPLY  // the receiver's byte shifted back for a LINK_DATA
+};
+
+// Everything carries the sender's cycle count, so the peer always knows
+// how far behind it is
+struct LinkMessage{
+    uint64_t time;
+    uint8_t type;
+    uint8_t data;
+};
+
+// One end of a link cable
+class LinkTransport{
+public:
+    virtual ~LinkTransport() = default;
+    virtual void send(const LinkMessage& message) = 0;
+    // Next message from the peer, waiting for one if wait is set. False
+    // when there is none, or the peer is gone.
+    virtual bool receive(LinkMessage& message, bool wait) = 0;
+    virtual bool connected() = 0;
+};
+
+// Both ends in one process, one ring per direction
+class LocalLink : public LinkTransport{
+    RingBuffer<LinkMessage>& in;
+    RingBuffer<LinkMessage>& out;
+    std::atomic<bool>& open;
+public:
+    LocalLink(RingBuffer<LinkMessage>& in,
+              RingBuffer<LinkMessage>& out, std::atomic<bool>& open);
+    void send(const LinkMessage& message) override;
+    bool receive(LinkMessage& message, bool wait) override;
+    bool connected() override;
+};
+class LocalCable{
+    RingBuffer<LinkMessage> forward;
+    RingBuffer<LinkMessage> backward;
+    std::atomic<bool> open{true};
+public:
+    LocalLink first;
+    LocalLink second;
+
+    LocalCable();
+    // Either side stops, the other one no longer waits for it
+    void unplug();
+};
+
+// Local Unix socket, one side listens on path and the other connects
+class SocketLink : public LinkTransport{
+    int fd{-1};
+    int listener{-1};
+    std::string path;
+    uint8_t partial[10];
+    int have{0};
+public:
+    ~SocketLink();
+    bool listen(const char* path);
+    bool connect(const char* path);
+    void send(const LinkMessage& message) override;
+    bool receive(LinkMessage& message, bool wait) override;
+    bool connected() override;
+};
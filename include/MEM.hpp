@@ -3,6 +3,7 @@
 #include <string>
 #include "Joypad.hpp"
 #include "types.hpp"
+#include "State.hpp"
 
 #define ROM_BANKSIZE 0x4000 /* 16K */
 #define WRAM_BANKSIZE 0x1000 /* 4K */
@@ -22,24 +23,43 @@ struct HDMAstate{
     uint8_t dst_low{0};
     uint8_t dst_hight{0};
     uint8_t hdma5{0};
+    // padding spelled out, save states copy the struct as it is
+    uint8_t reserved0{0};
 
     uint16_t src{0};
     uint16_t dst{0};
     uint16_t len{0};
     bool work{false};
+    uint8_t reserved1{0};
+};
+
+// Cartridge contents, read once and shared read-only by every machine
+// that loads them
+struct RomImage{
+    uint8_t* data{nullptr};
+    uint32_t size{0};
+    std::string filename;
+
+    ~RomImage();
+    bool readFromFile(const char* filename);
+    bool readFromMemory(const uint8_t* image, size_t length);
 };
 
 class APU;
 class PPU;
 class Joypad;
 class Timer;
+class Serial;
 class MemoryMaster{
     Timer* timer;
+    Serial* serial;
     APU* apu;
     PPU* ppu;
     Joypad* joypad;
 
-    uint8_t* ROM{nullptr};
+    const uint8_t* ROM{nullptr};
+    RomImage* ownImage{nullptr};
+    const RomImage* loadedImage{nullptr};
     uint8_t* CRAM{nullptr};
     uint8_t* RAM{nullptr};
     uint8_t* VRAM{nullptr};
@@ -78,6 +98,11 @@ class MemoryMaster{
     HDMAstate hdma;
 public:
     bool isCGB = false;
+    // IE, IF and STAT of this machine; CPU and PPU keep a reference
+    InterruptState IS;
+    // batch runs turn these off: no load messages, no .sv next to the rom
+    bool verbose = true;
+    bool saveFile = true;
 
     MemoryMaster();
     ~MemoryMaster();
@@ -87,6 +112,8 @@ public:
     uint8_t readVRAM1(uint16_t addr);
     uint8_t readVRAM(uint16_t addr);
     uint8_t readOAM(uint16_t addr);
+    const uint8_t* VRAMdata();
+    const uint8_t* OAMdata();
     uint8_t readIO(uint16_t addr);
 
     void write(uint16_t addr, uint8_t data);
@@ -95,10 +122,24 @@ public:
     void writeOAM(uint16_t addr, uint8_t data);
     void writeIO(uint16_t addr, uint8_t data);
     void HDMAstep();
+    bool HDMAactive();
     bool readFromFile(const char* filename);
+    // image has to outlive the machine
+    bool load(const RomImage& image);
+    // What load() was given, null before
+    const RomImage* image();
 
     void setTimer(Timer* master);
     void setJoypad(Joypad* master);
     void setPPU(PPU* master);
     void setAPU(APU* master);
+    void setSerial(Serial* master);
+
+    // Identifies the rom a state belongs to, from its header checksums
+    uint32_t cartridge();
+    // Banking, interrupts, HDMA and every RAM
+    void saveState(StateWriter& state);
+    bool loadState(StateReader& state);
+    // false if the state's banking does not fit this cartridge
+    bool checkState(StateReader& state);
 };
@@ -1,5 +1,9 @@
+#pragma once
 #include "types.hpp"
+#include "Color.hpp"
+#include "State.hpp"
 #include <cstdint>
+#include <vector>
 
 struct PPUState{
     uint8_t LCDC{0};
@@ -13,54 +17,143 @@ struct PPUState{
     uint8_t WY{0};
     uint8_t WX{0};
     uint8_t OPRI{0};
-    uint32_t BGcolorBuffer[32];
-    uint32_t OBcolorBuffer[32];
+    // padding spelled out, save states copy the struct as it is
+    uint8_t reserved{0};
+    uint32_t BGcolorBuffer[32]{};
+    uint32_t OBcolorBuffer[32]{};
+};
+
+// Draws one scanline from a register snapshot and the VRAM/OAM it saw,
+// so lines can be drawn out of order and on any thread.
+class LineRenderer{
+    const PPUState& self;
+    const uint8_t* VRAM;
+    const uint8_t* OAM;
+    bool isCGB;
+    uint8_t wline;
+
+    uint16_t foundSprits[10];
+    uint8_t founds = 0;
+    uint8_t BGlines[SCW];
+    uint8_t OBlines[SCW];
+
+    uint8_t readVRAM0(uint16_t addr){ return VRAM[addr - 0x8000]; }
+    uint8_t readVRAM1(uint16_t addr){ return VRAM[addr - 0x6000]; }
+    uint8_t readOAM(uint16_t addr){ return OAM[addr - 0xFE00]; }
+
+    void search();
+    void renderSprites();
+    void render_BG_line();
+    void render_window_line();
+    void drawline(int& x, int dx, int dy, uint16_t tilemap);
+public:
+    LineRenderer(const PPUState& state, uint8_t wline, const uint8_t* vram,
+                 const uint8_t* oam, bool isCGB);
+    void draw(uint32_t* line, uint8_t* indices, const uint32_t* shades);
 };
 
 class MemoryMaster;
-class Window;
+class Screen;
+class ThreadPool;
+class Scheduler;
 class PPU{
     PPUState self;
 
     MemoryMaster& MEM;
-    Window& screen;
+    InterruptState& IS;
+    Screen& screen;
+
+    uint32_t* framebuffer{nullptr};
+    uint32_t* userFramebuffer{nullptr};
+    uint8_t* indexBuffer{nullptr};
+    int pitch{SCW};
 
-    uint16_t foundSprits[10];
-    uint8_t founds = 0;
     uint8_t wline = 0;
+    // this frame is not drawn, the screen asked to drop it
+    bool dropping{false};
 
     int MODE = 0;
     int timeCounter = 0;
-    uint8_t BGlines[SCW];
-    uint8_t OBlines[SCW];
+    // Catch-up state: the cycle the PPU has run up to and cycles from
+    // there until the next event the CPU can notice without touching PPU
+    // memory, which is scheduled as EVENT_PPU.
+    Scheduler* scheduler{nullptr};
+    uint64_t syncedTo = 0;
+    int deadline = 0;
+    int offCounter = 0;
+
+    uint16_t BGP[32]{};
+    uint16_t OBP[32]{};
+    uint8_t BGsrc{0};
+    uint8_t OBsrc{0};
 
-    uint16_t BGP[32];
-    uint16_t OBP[32];
-    uint8_t BGsrc;
-    uint8_t OBsrc;
+    // Deferred rendering: lines only record their state while the frame
+    // runs and the whole frame is drawn at VBlank in bands on the pool.
+    // Every line keeps the VRAM/OAM version it saw, a write during the
+    // frame copies the old contents out only if a recorded line uses them.
+    struct LineJob{
+        PPUState state;
+        uint8_t wline;
+        uint8_t version;
+        bool valid;
+    };
+    ThreadPool* pool{nullptr};
+    std::vector<LineJob> lines;
+    std::vector<uint8_t> versions;
+    uint8_t version{0};
+    bool versionUsed{false};
+    void recordLine();
+    void flushLines();
 
-    void updateColor(uint32_t& color, uint16_t data);
+    ColorMode colorMode{COLOR_RAW};
+    const uint32_t* colors;
+    const uint32_t* shades;
+    uint32_t* frameLine();
+    void blankFrame();
+    void endFrame();
 
     void update();
+    void advance(int time);
     void setHBLANK();
     void setVBLANK();
     void setSEARCH();
     void setDRAWING();
     
-    void search();
     void drawing();
-    void renderSprites();
-    void render_BG_line();
-    void render_window_line();
-    
-    void drawline(int& x, int dx, int dy, uint16_t tilemap);
-    int cost();
+    int cost(int mode);
 
     void checkLYC();
 public:
-    PPU(MemoryMaster& master, Window& window);
-    void step(int time);
+    uint32_t frames{0};
+    // Hash of the last completed frame, only kept while hashFrames is set
+    bool hashFrames{false};
+    uint64_t frameHash{0};
+    // Frames still run but are neither drawn nor handed to the screen,
+    // which is not polled either. For frames run ahead.
+    bool hidden{false};
+
+    PPU(MemoryMaster& master, Screen& window);
+    ~PPU();
+    void setScheduler(Scheduler* master);
+    void sync();
+    void updateDeadline();
+    void setFramebuffer(uint32_t* buffer, int pitch);
+    void setIndexBuffer(uint8_t* buffer);
+    void setColorMode(ColorMode mode);
+    ColorMode getColorMode();
+    // Draw frames at VBlank over threads (0 = all cores), a negative
+    // count goes back to drawing every line as it ends.
+    void setParallel(int threads);
+    // Called by MemoryMaster before any VRAM or OAM write
+    void videoWrite();
 
     bool write(uint16_t addr, uint8_t data);
     bool read(uint16_t addr, uint8_t& data);
+
+    // Lines recorded for a deferred frame are dropped on load
+    void saveState(StateWriter& state);
+    bool loadState(StateReader& state);
+    // false if the mode, LY or the counters could not have been saved at
+    // cycle now, advance() would never get past them
+    bool checkState(StateReader& state, uint64_t now);
 };
\ No newline at end of file
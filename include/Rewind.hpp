@@ -0,0 +1,67 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "GameBoy.hpp"
+
+// What the history costs, for the stats line
+struct RewindStats{
+    uint64_t captures{0};
+    uint64_t steps{0};
+    double captureSeconds{0};  // saving states, on the emulation thread
+    double compressSeconds{0}; // deltas, on the worker
+    double stepSeconds{0};
+    uint64_t rawBytes{0};      // states before compression
+    uint64_t storedBytes{0};   // and after
+};
+
+// History of save states taken every interval frames. The newest one is
+// kept whole, every older one as the XOR with its successor,
+// run-length compressed by a worker thread, so stepping back is one
+// decompress and one load. The oldest states go once the deltas pass
+// budget bytes.
+class Rewind{
+    GameBoy& GB;
+    int interval;
+    size_t budget;
+    size_t stateBytes{0};
+    int counter{0};
+
+    std::vector<uint8_t> head;
+    bool atHead{false};
+    std::deque<std::vector<uint8_t>> history;
+    size_t historyBytes{0};
+
+    // raw states on their way to the worker, and buffers to reuse
+    std::deque<std::vector<uint8_t>> pending;
+    std::vector<std::vector<uint8_t>> spare;
+    std::vector<uint8_t> delta;
+    std::thread worker;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    bool busy{false};
+    bool stop{false};
+
+    void work();
+    void store(std::vector<uint8_t>& state);
+    void settle();
+public:
+    RewindStats stats;
+
+    Rewind(GameBoy& machine, int interval, size_t budget);
+    ~Rewind();
+    // After every frame played forward
+    void frame();
+    // Puts the machine back one snapshot, the newest first. At the
+    // oldest it stays there and returns false.
+    bool stepBack();
+    void clear();
+    // Snapshots held and bytes used by them. Both wait for the worker,
+    // after which stats can be read too.
+    size_t size();
+    size_t bytes();
+};
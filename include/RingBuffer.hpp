@@ -0,0 +1,61 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+// Lock-free single producer / single consumer ring, one thread may push
+// and one other thread may pop. The size is rounded up to a power of two.
+template<typename T>
+class RingBuffer{
+    std::vector<T> items;
+    uint32_t mask;
+    alignas(64) std::atomic<uint32_t> head{0}; // next to pop, owned by the consumer
+    alignas(64) std::atomic<uint32_t> tail{0}; // next to push, owned by the producer
+public:
+    explicit RingBuffer(uint32_t size){
+        uint32_t rounded = 1;
+        while (rounded < size) rounded <<= 1;
+        items.resize(rounded);
+        mask = rounded - 1;
+    }
+    bool push(const T& item){
+        uint32_t end = tail.load(std::memory_order_relaxed);
+        if (end - head.load(std::memory_order_acquire) == capacity()) return false;
+        items[end & mask] = item;
+        tail.store(end + 1, std::memory_order_release);
+        return true;
+    }
+    // Oldest item without removing it
+    bool peek(T& item){
+        uint32_t begin = head.load(std::memory_order_relaxed);
+        if (begin == tail.load(std::memory_order_acquire)) return false;
+        item = items[begin & mask];
+        return true;
+    }
+    void pop(){
+        head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+    // Bulk versions, return how many items were moved
+    uint32_t push(const T* data, uint32_t count){
+        uint32_t end = tail.load(std::memory_order_relaxed);
+        uint32_t space = capacity() - (end - head.load(std::memory_order_acquire));
+        if (count > space) count = space;
+        for (uint32_t i = 0; i < count; i++) items[(end + i) & mask] = data[i];
+        tail.store(end + count, std::memory_order_release);
+        return count;
+    }
+    uint32_t pop(T* data, uint32_t count){
+        uint32_t begin = head.load(std::memory_order_relaxed);
+        uint32_t available = tail.load(std::memory_order_acquire) - begin;
+        if (count > available) count = available;
+        for (uint32_t i = 0; i < count; i++) data[i] = items[(begin + i) & mask];
+        head.store(begin + count, std::memory_order_release);
+        return count;
+    }
+    uint32_t capacity(){
+        return mask + 1;
+    }
+    uint32_t size(){
+        return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+    }
+};
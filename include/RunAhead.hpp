@@ -0,0 +1,38 @@
+#pragma once
+#include <vector>
+
+#include "GameBoy.hpp"
+
+// Where the time of a frame goes, for the stats line
+struct RunAheadStats{
+    uint64_t frames{0};
+    double frameSeconds{0}; // the real frame, with sound
+    double saveSeconds{0};
+    double aheadSeconds{0}; // frames run ahead, the shown one included
+    double loadSeconds{0};
+};
+
+struct AheadMachine;
+// Shows every frame as it will look count frames later, so input shows up
+// that much sooner. frame() runs the real frame with sound but unseen,
+// saves, runs count frames ahead without sound, shows the last of them
+// and loads the save again. With a second machine the frames ahead run
+// there from the save instead, and the real one is never loaded into.
+// Input is assumed held over the frames ahead.
+class RunAhead{
+    GameBoy& GB;
+    int count;
+    AheadMachine* second{nullptr};
+    std::vector<uint8_t> state;
+
+    void runAhead(GameBoy& machine);
+public:
+    RunAheadStats stats;
+
+    // The rom has to be loaded already when second is set
+    RunAhead(GameBoy& machine, int frames, bool second);
+    ~RunAhead();
+    void frame();
+    // The machine the last frame was shown from
+    GameBoy& shown();
+};
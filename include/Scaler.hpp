@@ -0,0 +1,40 @@
+#pragma once
+#include <vector>
+
+#include "ThreadPool.hpp"
+#include "types.hpp"
+
+enum ScaleFilter{
+    FILTER_NEAREST = 0,
+    FILTER_SCALEX = 1, // scale2x / scale3x, 4x is scale2x applied twice
+    FILTER_HQ = 2,     // hqx-style blending across YUV edges
+    FILTER_XBR = 3     // xBR-style corner edge rules
+};
+
+// CPU-side upscaler for SCW x SCH RGBA frames. Every filter runs in
+// horizontal bands spread over a small thread pool.
+class Upscaler{
+    ScaleFilter filter;
+    int factor;
+    ThreadPool pool;
+
+    std::vector<uint32_t> yuv;
+    std::vector<uint32_t> temp;
+    // Per output subpixel of a factor x factor block: quadrant and the
+    // 0-256 blend weights toward an edge and toward the diagonal pixel
+    std::vector<uint8_t> quadrant;
+    std::vector<uint16_t> edgeWeight;
+    std::vector<uint16_t> cornerWeight;
+
+    void bands(int rows, const std::function<void(int, int)>& task);
+    void yuvRows(const uint32_t* src, int pitch, int y0, int y1);
+    void hqRows(const uint32_t* src, int pitch, uint32_t* dst, int dstPitch, int y0, int y1);
+    void xbrRows(const uint32_t* src, int pitch, uint32_t* dst, int dstPitch, int y0, int y1);
+public:
+    Upscaler(ScaleFilter filter, int factor, int threads = 0);
+
+    int scaleFactor();
+    void scale(const uint32_t* src, int srcPitch, uint32_t* dst, int dstPitch);
+};
+
+bool parseScaleFilter(const char* name, ScaleFilter& filter);
@@ -0,0 +1,53 @@
+#pragma once
+#include <cstdint>
+
+#include "State.hpp"
+
+#define STATE_HORIZON (uint64_t(1) << 25) // 8 s, no event is pending further ahead
+
+// Things that happen at a known cycle. Events due at the same cycle run
+// in this order.
+enum EventType{
+    EVENT_PPU,       // next PPU point that raises an interrupt or ends a frame
+    EVENT_TIMER,     // TIMA overflow
+    EVENT_SEQUENCER, // DIV bit 12 falling, clocks the APU frame sequencer
+    EVENT_AUDIO,     // a block of samples is complete
+    EVENT_SERIAL,    // a transfer ends or the link cable is due a look
+    EVENT_COUNT
+};
+
+// Master cycle counter and the pending events, at most one per type, in
+// a min-heap. Components reschedule their event whenever a register
+// write moves it; the CPU runs instructions until the earliest one.
+class Scheduler{
+    struct Event{
+        uint64_t time;
+        uint8_t type;
+    };
+    Event heap[EVENT_COUNT];
+    int8_t slot[EVENT_COUNT]; // heap index of every type, -1 if not scheduled
+    int count{0};
+
+    bool before(const Event& a, const Event& b);
+    void place(int index, const Event& event);
+    void up(int index);
+    void down(int index);
+    void remove(int index);
+public:
+    // cycles run since power on, in single speed cycles
+    uint64_t now{0};
+
+    Scheduler();
+    // Replaces the type's pending event, if any
+    void schedule(EventType type, uint64_t time);
+    void cancel(EventType type);
+    uint64_t next(){ return count ? heap[0].time : UINT64_MAX; }
+    // Takes the earliest event if it is due
+    bool pop(EventType& type);
+
+    void saveState(StateWriter& state);
+    bool loadState(StateReader& state);
+    // false unless every event is due between now and STATE_HORIZON
+    // after it; now is the state's cycle count
+    bool checkState(StateReader& state, uint64_t& now);
+};
@@ -0,0 +1,27 @@
+#pragma once
+#include "Joypad.hpp"
+#include "types.hpp"
+
+// What paces the emulation in real time
+enum SyncMode{
+    SYNC_VIDEO = 0, // frames at the Game Boy rate, audio resampled to follow
+    SYNC_AUDIO = 1  // audio output blocks, frames are shown as they come
+};
+
+// Where the PPU presents frames: an SDL window or a headless buffer
+class Screen{
+public:
+    Joypad joypad;
+    // held down to play the rewind history backwards
+    bool rewinding{false};
+    // set by a screen that would not present the next frame, which the
+    // PPU then does not draw
+    bool dropNext{false};
+
+    virtual ~Screen() = default;
+    // Memory for the next frame, pitch is in pixels. Valid until show().
+    virtual uint32_t* lockFrame(int& pitch) = 0;
+    virtual void show() = 0;
+    virtual void poolEvents() = 0;
+    virtual bool isOpen() = 0;
+};
@@ -0,0 +1,21 @@
+#pragma once
+#include <vector>
+
+#include "Joypad.hpp"
+
+struct InputEvent{
+    uint32_t frame;
+    uint8_t directions;
+    uint8_t buttons;
+};
+
+// Scripted joypad input. Every line of the file is a frame number
+// followed by the buttons held from that frame on, e.g. "120 A RIGHT".
+// Buttons: A B SELECT START RIGHT LEFT UP DOWN, '#' starts a comment.
+class InputScript{
+    std::vector<InputEvent> events;
+    size_t next{0};
+public:
+    bool load(const char* filename);
+    void apply(uint32_t frame, Joypad& joypad);
+};
@@ -0,0 +1,51 @@
+#pragma once
+#include <deque>
+
+#include "types.hpp"
+#include "Link.hpp"
+#include "State.hpp"
+
+#define LINK_POLL 512    // cycles between looks at the cable, one bit at 8192 Hz
+#define LINK_WINDOW 2048 // furthest a side may run ahead of its peer
+
+class Scheduler;
+// Serial port (SB/SC). A transfer on the internal clock takes 8 bit
+// times and sends SB to the peer, which shifts its own SB back; with no
+// cable it reads 0xFF. On the external clock SB waits for the peer's
+// clock. Both sides poll the cable every LINK_POLL cycles and wait
+// whenever they get more than LINK_WINDOW cycles ahead of each other.
+class Serial{
+    uint8_t SB{0};
+    uint8_t SC{0};
+
+    Scheduler* scheduler{nullptr};
+    InterruptState* IS{nullptr};
+    LinkTransport* link{nullptr};
+    bool transfer{false};
+    uint64_t doneAt{0};
+    bool replied{false};
+    uint8_t reply{0xFF};
+    uint64_t peerTime{0};
+    uint64_t sentTime{0};
+    // bytes clocked by the peer, handled once this side reaches them
+    std::deque<LinkMessage> clocked;
+
+    void handle(const LinkMessage& message);
+    void answer();
+    void exchange();
+    void complete(uint8_t data);
+    void reschedule();
+public:
+    void setScheduler(Scheduler* master);
+    void setInterrupts(InterruptState* master);
+    void setLink(LinkTransport* transport);
+    // EVENT_SERIAL is due
+    void update();
+
+    bool write(uint16_t addr, uint8_t data);
+    bool read(uint16_t addr, uint8_t& data);
+
+    // The port only, a cable session does not survive a load
+    void saveState(StateWriter& state);
+    bool loadState(StateReader& state);
+};
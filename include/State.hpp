@@ -0,0 +1,62 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Save states: a StateHeader, then one section per component, each a
+// StateSection and that component's fixed-layout structs and memory
+// copied as they are. Little-endian throughout. A state only loads into
+// a machine running the same cartridge.
+#define STATE_MAGIC 0x54534242 // "BBST"
+#define STATE_VERSION 2
+#define STATE_ID(a, b, c, d) (uint32_t(a) | uint32_t(b) << 8 | uint32_t(c) << 16 | uint32_t(d) << 24)
+
+struct StateHeader{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;      // whole state, header included
+    uint32_t cartridge; // header and global checksums of the rom
+};
+struct StateSection{
+    uint32_t id;
+    uint32_t size;      // bytes after this header
+};
+
+// Writes into a buffer sized by a first pass without one (data null),
+// which only counts and notes the sections
+class StateWriter{
+    uint8_t* data;
+    size_t capacity;
+    size_t used{0};
+    size_t section{0};
+    std::vector<StateSection> sections;
+public:
+    StateWriter(uint8_t* buffer, size_t size);
+    void begin(uint32_t id);
+    void put(const void* source, size_t size);
+    template<typename T> void put(const T& value){ put(&value, sizeof(T)); }
+    void end();
+    size_t size(){ return used; }
+    // false once a put did not fit
+    bool fits(){ return used <= capacity || !data; }
+    // ids and sizes of the sections counted
+    const std::vector<StateSection>& layout(){ return sections; }
+};
+
+class StateReader{
+    const uint8_t* data;
+    size_t length;
+    size_t position{0};
+    size_t sectionEnd{0};
+public:
+    StateReader(const uint8_t* buffer, size_t size);
+    // Magic, version and size, false if the state is not usable
+    bool header(StateHeader& header);
+    // Moves to the section id, wherever it is
+    bool begin(uint32_t id);
+    bool get(void* target, size_t size);
+    template<typename T> bool get(T& value){ return get(&value, sizeof(T)); }
+    bool skip(size_t size);
+    // Every section of layout is there with the same size
+    bool matches(const std::vector<StateSection>& layout);
+};
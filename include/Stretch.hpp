@@ -0,0 +1,31 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#define STRETCH_GRAIN 1024   // frames per grain, ~21 ms at 48 kHz
+#define STRETCH_SEARCH 512   // frames a grain may move to line up
+#define STRETCH_MIN 0.25     // speeds it handles, outside them sound is muted
+#define STRETCH_MAX 4.0
+
+// Time-stretches interleaved stereo by WSOLA: Hann windowed grains are
+// read from the input speed times further apart than they are written,
+// each moved by up to STRETCH_SEARCH frames to where it best continues
+// the last one. The sound keeps its pitch and lasts 1/speed as long.
+class TimeStretch{
+    std::vector<float> input;
+    std::vector<float> overlap;
+    float window[STRETCH_GRAIN];
+    // where the next grain should start in input and where the last one
+    // would have gone on, in frames
+    double position{STRETCH_SEARCH};
+    long natural{-1};
+    double speed{1.0};
+
+    long bestGrain(long nominal);
+public:
+    TimeStretch();
+    void setSpeed(double speed);
+    // Appends what is ready of the stretched stream to out
+    void process(const int16_t* samples, int count, std::vector<int16_t>& out);
+    void clear();
+};
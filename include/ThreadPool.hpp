@@ -0,0 +1,30 @@
+#pragma once
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Small persistent pool for splitting one frame's work into bands.
+// run() blocks until every index is done, the caller thread helps.
+class ThreadPool{
+    std::vector<std::thread> workers;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable done;
+
+    const std::function<void(int)>* job{nullptr};
+    int count{0};
+    int next{0};
+    int finished{0};
+    bool stop{false};
+
+    void work();
+public:
+    // threads counts the caller too, 0 picks the number of cores
+    ThreadPool(int threads = 0);
+    ~ThreadPool();
+
+    int size();
+    void run(int jobs, const std::function<void(int)>& task);
+};
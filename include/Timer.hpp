@@ -1,20 +1,52 @@
+#pragma once
 #include "types.hpp"
+#include "State.hpp"
 
+// DIV is the top of a 16 bit counter running since divBase, TIMA holds
+// its value as of counter timaAt and moves on every falling edge of the
+// counter bit TAC selects. Nothing runs per instruction: registers are
+// worked out when touched and TIMA overflow is an EVENT_TIMER deadline.
 struct TimerState{
-    uint16_t internalDIV{0};
-    uint16_t internalTIMA{0};
-    uint8_t DIV{0};
+    uint64_t divBase{0};
+    uint64_t timaAt{0};
     uint8_t TIMA{0};
     uint8_t TMA{0};
     uint8_t TAC{0};
+    // padding spelled out, save states copy the struct as it is
+    uint8_t reserved[5]{};
 };
 
 class MemoryMaster;
+class APU;
+class Scheduler;
 class Timer{
     TimerState self;
+    APU* apu{nullptr};
+    Scheduler* scheduler{nullptr};
+    InterruptState* IS{nullptr};
+
+    uint64_t counter();
+    void tick(uint64_t ticks);
+    void scheduleOverflow();
 public:
-    void step(int time);
+    void setAPU(APU* master);
+    void setScheduler(Scheduler* master);
+    void setInterrupts(InterruptState* master);
+    // Brings TIMA up to now, raising the interrupt if it wrapped
+    void sync();
+    // EVENT_SEQUENCER is due
+    void sequencerEdge();
+    // The event only runs while the APU has a sink to render for
+    void scheduleSequencer();
+    // Falling edges of the sequencer bit since DIV was reset
+    uint32_t sequencerEdges();
 
     bool write(uint16_t addr, uint8_t data);
     bool read(uint16_t addr, uint8_t& data);
-};
\ No newline at end of file
+
+    // events are scheduled again from the loaded counters
+    void saveState(StateWriter& state);
+    bool loadState(StateReader& state);
+    // false if DIV was reset or TIMA synced after cycle now
+    bool checkState(StateReader& state, uint64_t now);
+};
@@ -0,0 +1,65 @@
+#pragma once
+/* C interface to the emulator core, for embedding without SDL.
+ * A handle is one machine; different handles may run on different
+ * threads, one handle is not thread safe. */
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BYTEBOY_WIDTH 160
+#define BYTEBOY_HEIGHT 144
+
+/* set_input bits, 1 = held */
+enum{
+    BYTEBOY_A = 0x01,
+    BYTEBOY_B = 0x02,
+    BYTEBOY_SELECT = 0x04,
+    BYTEBOY_START = 0x08,
+    BYTEBOY_RIGHT = 0x10,
+    BYTEBOY_LEFT = 0x20,
+    BYTEBOY_UP = 0x40,
+    BYTEBOY_DOWN = 0x80
+};
+
+typedef struct byteboy byteboy;
+
+byteboy* byteboy_create(void);
+void byteboy_destroy(byteboy* gb);
+
+/* Both start the machine over with the new cartridge, 0 on failure.
+ * The memory image is copied. Battery saves are not read or written. */
+int byteboy_load_rom_file(byteboy* gb, const char* path);
+int byteboy_load_rom_memory(byteboy* gb, const void* data, size_t size);
+
+/* Runs until the next frame is done, or for at least cycles CPU cycles */
+void byteboy_run_frame(byteboy* gb);
+void byteboy_run_cycles(byteboy* gb, uint64_t cycles);
+uint64_t byteboy_cycles(const byteboy* gb);
+
+void byteboy_set_input(byteboy* gb, uint8_t buttons);
+
+/* BYTEBOY_WIDTH x BYTEBOY_HEIGHT RGBA pixels, valid until destroy */
+const uint32_t* byteboy_framebuffer(const byteboy* gb);
+uint64_t byteboy_frame_hash(const byteboy* gb);
+
+/* rate 0 (the default) renders no sound, a new rate applies from the next
+ * load. Otherwise interleaved stereo samples pile up until read:
+ * audio_samples moves up to frames of them into out and returns how
+ * many it moved. */
+void byteboy_set_audio(byteboy* gb, int rate);
+size_t byteboy_audio_available(const byteboy* gb);
+size_t byteboy_audio_samples(byteboy* gb, int16_t* out, size_t frames);
+
+/* Save states of the running cartridge, state_size bytes each. Both
+ * return 0 on failure; a state from another cartridge or version, or
+ * a damaged one, does not load and leaves the machine as it was. */
+size_t byteboy_state_size(byteboy* gb);
+int byteboy_save_state(byteboy* gb, void* buffer, size_t size);
+int byteboy_load_state(byteboy* gb, const void* buffer, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
@@ -3,6 +3,8 @@
 
 #define SCW 160
 #define SCH 144
+#define CPU_CLOCK 4194304
+#define FRAME_CYCLES 70224
 
 enum INTERRUPTS {
     VBLANK = 0x1,
@@ -16,6 +18,4 @@ struct InterruptState{
     uint8_t IE{0};
     uint8_t IF{0};
     uint8_t STAT{0};
-};
-
-inline InterruptState IS;
\ No newline at end of file
+};
\ No newline at end of file
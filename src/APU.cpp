@@ -1,343 +1,489 @@
-#include <SDL2/SDL.h>
-#include <cmath>
+#include <algorithm>
+#include <cstring>
 
 #include "../include/APU.hpp"
 #include "../include/MEM.hpp"
-
-#define SAMPLE_RATE 48000
-#define AMPLITUDE 28000
-#define EVELOPE_RATE SAMPLE_RATE / 64
-#define SWEEP_RATE SAMPLE_RATE / 128
-#define LENGHT_RATE SAMPLE_RATE / 256
+#include "../include/Scheduler.hpp"
+#include "../include/Timer.hpp"
 
 static const uint8_t divisor_table[8] = {8, 16, 32, 48, 64, 80, 96, 112};
-static const float duty_table[4] = {0.125f, 0.250f, 0.500f, 0.750f};
-static const float envelope_table[4] = {0.0f, 1.0f, 0.5f, 0.25f};
-
-static void audioCallback(void* userdata, Uint8* stream, int len) {
-    APU* self = static_cast<APU*>(userdata);
-    
-    Channel& ch1 = self->SweepChannel;
-    Channel& ch2 = self->BahChannel;
-    Channel& ch3 = self->WaveChannel;
-    Channel& ch4 = self->NoiseChannel;
-    Sint16* buffer = reinterpret_cast<Sint16*>(stream);
-    int samples = len / sizeof(Sint16);
-
-    uint8_t counter_step = (self->NR43 >> 3) & 1;
-    float ch1F = (131072.0f / (2048.0f - ch1.current_F)) / SAMPLE_RATE;
-    float ch2F = (131072.0f / (2048.0f - ch2.current_F)) / SAMPLE_RATE;
-    float ch3F = (131072.0f / (2048.0f - ch3.current_F)) / SAMPLE_RATE;
-    float ch4F = (4194304.0f / (ch4.current_F << (self->NR43 >> 4))) / SAMPLE_RATE;
-
-    float vol1 = (ch1.envelope_volume / 15.0f) * 0.25f;
-    float vol2 = (ch2.envelope_volume / 15.0f) * 0.25f;
-    float vol3 = envelope_table[ch3.envelope_volume] * 0.2f;
-    float vol4 = (ch4.envelope_volume / 15.0f) * 0.2f;
-
-    bool dac_enabled = self->NR30 & 0x80;
-    for (int i = 0; i < samples; i+=2) {
-        float mixed_left = 0.f;
-        float mixed_right = 0.f;
-        if (ch1.active) {
-            ch1.phase += ch1F;
-            if (ch1.phase >= 1.0f) ch1.phase -= 1.0f;
-            
-            float sample = (fmod(ch1.phase, 1.0f) < ch1.duty) ? 1.0f : 0.0f;
-            
-            sample *= vol1;
-            
-            if (self->NR51 & 0x10) {
-                mixed_left += sample;
-            }
-            if (self->NR51 & 0x01) {
-                mixed_right += sample;
-            }
-            
-            self->updateSweep(ch1);
-            
-            self->updateEvelope(ch1);
-            self->updateLenght(ch1);
-        }
-        
-        if (ch2.active) {
-            ch2.phase += ch2F;
-            if (ch2.phase >= 1.0f) ch2.phase -= 1.0f;
-
-            float sample = (fmod(ch2.phase, 1.0f) < ch2.duty) ? 1.0f : 0.0f;
+static const uint8_t duty_table[4] = {0x01, 0x81, 0x87, 0x7E};
+// Output of a channel at level 15 with NR50 at 7, all four stay under 28000
+static const int amplitude_table[4] = {466, 466, 373, 373};
 
-            sample *= vol2;
-            
-            if (self->NR51 & 0x20) {
-                mixed_left += sample;
-            }
-            if (self->NR51 & 0x02) {
-                mixed_right += sample;
-            }
-            
-            self->updateEvelope(ch2);
-            self->updateLenght(ch2);
-        }
-        if (ch3.active && dac_enabled) {
-            ch3.phase += ch3F;
-            if (ch3.phase >= 1.0f) ch3.phase -= 1.0f;
-            
-            int sample_index = (int)(ch3.phase * 32.0f) % 32;
-            
-            uint8_t wave_byte = self->wave_ram[sample_index / 2];
-            uint8_t sample_4bit;
-            
-            if (sample_index % 2 == 0) {
-                sample_4bit = wave_byte >> 4;
-            } else {
-                sample_4bit = wave_byte & 0x0F;
-            }
-            
-            float sample = (float)sample_4bit / 15.0f;
-            
-            sample *= vol3;
-            
-            if (self->NR51 & 0x40) {
-                mixed_left += sample;
-            }
-            if (self->NR51 & 0x04) {
-                mixed_right += sample;
-            }
-            
-            self->updateLenght(ch3);
+AudioRenderer::AudioRenderer()
+{
+    blipLeft.setRates(CPU_CLOCK, SAMPLE_RATE);
+    blipRight.setRates(CPU_CLOCK, SAMPLE_RATE);
+}
+// Only between blocks, when nothing is pending in the blip buffers
+void AudioRenderer::setSampleRate(double rate){
+    blipLeft.setRates(CPU_CLOCK, rate);
+    blipRight.setRates(CPU_CLOCK, rate);
+}
+Channel& AudioRenderer::channel(int index){
+    switch (index) {
+        case 0: return SweepChannel;
+        case 1: return BahChannel;
+        case 2: return WaveChannel;
+    }
+    return NoiseChannel;
+}
+// Cycles per duty step, wave sample or LFSR shift
+int AudioRenderer::period(int index){
+    switch (index) {
+        case 0: return (2048 - SweepChannel.current_F) * 4;
+        case 1: return (2048 - BahChannel.current_F) * 4;
+        case 2: return (2048 - WaveChannel.current_F) * 2;
+    }
+    return divisor_table[NR43 & 0x07] << (NR43 >> 4);
+}
+// Digital output 0-15
+int AudioRenderer::level(int index){
+    Channel& ch = channel(index);
+    if (!ch.active) return 0;
+    switch (index) {
+        case 0:
+        case 1:
+            return ((duty_table[ch.duty] >> ch.position) & 1) ? ch.envelope_volume : 0;
+        case 2:{
+            if (!(NR30 & 0x80) || !ch.envelope_volume) return 0;
+            uint8_t byte = wave_ram[ch.position / 2];
+            uint8_t sample = (ch.position & 1) ? (byte & 0x0F) : (byte >> 4);
+            return sample >> (ch.envelope_volume - 1);
         }
-
-        if (ch4.active) {
-            ch4.phase += ch4F;
-            
-            if (ch4.phase >= 1.0f) {
-                ch4.phase -= 1.0f;
-                uint16_t feedback = (ch4.lfsr & 1) ^ ((ch4.lfsr >> 1) & 1);
-                ch4.lfsr >>= 1;
-                ch4.lfsr |= feedback << 14;
-                if (counter_step){
-                    ch4.lfsr &= ~0x40; // reset bit 7
-                    ch4.lfsr |= feedback << 6;
-                }
-            }
-            float sample = -(~(ch4.lfsr) & 1) * vol4;
-            
-            if (self->NR51 & 0x80) {
-                mixed_left += sample;
-            }
-            if (self->NR51 & 0x08) {
-                mixed_right += sample;
-            }
-
-            self->updateEvelope(ch4);
-            self->updateLenght(ch4);
+    }
+    return (ch.lfsr & 1) ? 0 : ch.envelope_volume;
+}
+void AudioRenderer::setMask(uint8_t channels){
+    mask = channels;
+    updateGains();
+}
+// Panning and master volume only change on register writes, the mixer
+// then just looks up the output of a level
+void AudioRenderer::updateGains(){
+    for (int i = 0; i < 4; i++){
+        bool heard = mask & (1 << i);
+        int left = (heard && (NR51 & (0x10 << i))) ? NR50 & 0x7 : 0;
+        int right = (heard && (NR51 & (0x01 << i))) ? (NR50 >> 4) & 0x7 : 0;
+        for (int level = 0; level < 16; level++){
+            int amplitude = level * amplitude_table[i];
+            gains[i][0][level] = amplitude * left / 7;
+            gains[i][1][level] = amplitude * right / 7;
         }
-        buffer[i] = AMPLITUDE * mixed_left * self->leftVolume;
-        buffer[i+1] = AMPLITUDE * mixed_right * self->rightVolume;
     }
 }
-APU::APU()
-{
-    spec.freq = SAMPLE_RATE;
-    spec.format = AUDIO_S16SYS;
-    spec.channels = 2;
-    spec.samples = 2048;
-    spec.callback = audioCallback;
-    spec.userdata = this;
-    device = SDL_OpenAudioDevice(nullptr, 0, &spec, nullptr, 0);
-    SDL_PauseAudioDevice(device, 0);
+// Adds the change of a channel's panned output at cycle at
+void AudioRenderer::mix(int index, uint64_t at){
+    Channel& ch = channel(index);
+    int current = level(index);
+    int left = gains[index][0][current];
+    int right = gains[index][1][current];
+    if (left != ch.left){
+        blipLeft.addDelta(at - frameStart, left - ch.left);
+        ch.left = left;
+    }
+    if (right != ch.right){
+        blipRight.addDelta(at - frameStart, right - ch.right);
+        ch.right = right;
+    }
 }
-APU::~APU(){
-    if (device) SDL_CloseAudioDevice(device);
-}
-void APU::updateEvelope(Channel& ch){
-    ch.envelope_counter++;
-    if (ch.envelope_counter >= EVELOPE_RATE) {
-        ch.envelope_counter -= EVELOPE_RATE;
-        if (ch.envelope_period > 0) {
-            if (ch.envelope_volume == 0 || ch.envelope_volume == 15) {
-                ch.envelope_period = 0;
-                return;
+// Steps the waveform up to until. A channel that can't be heard, muted
+// or panned nowhere, only moves its position, an audible one adds every transition.
+void AudioRenderer::clockChannel(int index, uint64_t until){
+    Channel& ch = channel(index);
+    if (!ch.active) return;
+    int cycles = period(index);
+    uint64_t at = time + ch.timer;
+    if (at > until){
+        ch.timer = at - until;
+        return;
+    }
+    bool audible = (index == 2) ? (NR30 & 0x80) && ch.envelope_volume : ch.envelope_volume;
+    audible = audible && (gains[index][0][15] || gains[index][1][15]);
+    if (!audible){
+        uint64_t steps = (until - at) / cycles + 1;
+        if (index == 2) ch.position = (ch.position + steps) % 32;
+        else if (index < 2) ch.position = (ch.position + steps) % 8;
+        ch.timer = at + steps * cycles - until;
+        return;
+    }
+    for (; at <= until; at += cycles){
+        if (index == 3){
+            uint16_t feedback = (ch.lfsr & 1) ^ ((ch.lfsr >> 1) & 1);
+            ch.lfsr >>= 1;
+            ch.lfsr |= feedback << 14;
+            if (NR43 & 0x08){
+                ch.lfsr &= ~0x40; // reset bit 7
+                ch.lfsr |= feedback << 6;
             }
-            if (ch.direction) ch.envelope_volume++;
-            else ch.envelope_volume--;
+        }else{
+            ch.position = (ch.position + 1) % ((index == 2) ? 32 : 8);
         }
+        mix(index, at);
     }
+    ch.timer = at - until;
 }
-void APU::updateLenght(Channel& ch){
-    ch.length_counter ++;
-    
-    if (ch.length_counter >= LENGHT_RATE) {
-        ch.length_counter -= LENGHT_RATE;
-        ch.length_timer--;
-        if (ch.length_timer == 0) {
-            ch.active = false;
-        }
+// 512 Hz from DIV: length on even steps, sweep on 2 and 6, envelope on 7
+void AudioRenderer::clockSequencer(){
+    if (!(sequencerStep & 1)){
+        updateLenght(SweepChannel);
+        updateLenght(BahChannel);
+        updateLenght(WaveChannel);
+        updateLenght(NoiseChannel);
     }
+    if (sequencerStep == 2 || sequencerStep == 6) updateSweep(SweepChannel);
+    if (sequencerStep == 7){
+        updateEvelope(SweepChannel);
+        updateEvelope(BahChannel);
+        updateEvelope(NoiseChannel);
+    }
+    sequencerStep = (sequencerStep + 1) & 7;
+    for (int i = 0; i < 4; i++) mix(i, time);
+}
+void AudioRenderer::run(uint64_t until){
+    if (until <= time) return;
+    for (int i = 0; i < 4; i++) clockChannel(i, until);
+    time = until;
+}
+uint64_t AudioRenderer::timeFor(int frames){
+    return frameStart + blipLeft.clocksNeeded(frames);
+}
+int AudioRenderer::read(int16_t* buffer, int frames){
+    blipLeft.endFrame(time - frameStart);
+    blipRight.endFrame(time - frameStart);
+    frameStart = time;
+    blipLeft.read(buffer, frames, 2);
+    return blipRight.read(buffer + 1, frames, 2);
+}
+void AudioRenderer::updateEvelope(Channel& ch){
+    if (!ch.envelope_period || --ch.envelope_timer) return;
+    ch.envelope_timer = ch.envelope_period;
+    if (ch.direction && ch.envelope_volume < 15) ch.envelope_volume++;
+    else if (!ch.direction && ch.envelope_volume > 0) ch.envelope_volume--;
+}
+void AudioRenderer::updateLenght(Channel& ch){
+    if (!ch.length_enabled || !ch.length_timer) return;
+    if (--ch.length_timer == 0) ch.active = false;
 }
-void APU::updateSweep(Channel& ch){
+void AudioRenderer::updateSweep(Channel& ch){
     uint8_t sweep_time = (NR10 >> 4) & 0x7;
-    if (sweep_time == 0) return;
+    if (ch.sweep_timer && --ch.sweep_timer) return;
+    ch.sweep_timer = sweep_time ? sweep_time : 8;
+    if (!sweep_time) return;
 
-    ch.sweep_counter++;
-    
-    if (ch.sweep_counter >= SWEEP_RATE*sweep_time) {
-        ch.sweep_counter -= SWEEP_RATE*sweep_time;
-        
-        uint8_t N = NR10 & 0x7;
-        uint16_t delta = ch.current_F >> N;
-        uint8_t decreace = (NR10 >> 3) & 1;
-        if (decreace) {
-            if (delta >= ch.current_F) {
-                ch.active = false;
-            }
-            ch.current_F -= delta;
-        } else {
-            ch.current_F += delta;
-            if (ch.current_F > 2047) {
-                ch.active = false;
-            }
-        }
+    uint8_t N = NR10 & 0x7;
+    uint16_t delta = ch.current_F >> N;
+    uint8_t decreace = (NR10 >> 3) & 1;
+    uint16_t next = decreace ? ch.current_F - delta : ch.current_F + delta;
+    if (next > 2047) ch.active = false;
+    else if (N) ch.current_F = next;
+}
+void AudioRenderer::trigger(int index, uint8_t data){
+    Channel& ch = channel(index);
+    ch.length_enabled = data & 0x40;
+    if (!(data & 0x80)) return;
+
+    ch.active = true;
+    if (!ch.length_timer) ch.length_timer = (index == 2) ? 256 : 64;
+    ch.timer = period(index);
+    ch.envelope_timer = ch.envelope_period;
+    switch (index) {
+        case 0:
+            ch.envelope_volume = NR12 >> 4;
+            ch.sweep_timer = ((NR10 >> 4) & 0x7) ? (NR10 >> 4) & 0x7 : 8;
+            break;
+        case 1:
+            ch.envelope_volume = NR22 >> 4;
+            break;
+        case 2:
+            ch.position = 0;
+            break;
+        case 3:
+            ch.envelope_volume = NR42 >> 4;
+            ch.lfsr = 0x7FFF;
+            break;
     }
 }
 
-bool APU::write(uint16_t addr, uint8_t data){
-    if (addr > 0xFF3F) return false;
+void AudioRenderer::apply(uint16_t addr, uint8_t data){
+    if (addr == AUDIO_SEQUENCER){
+        if (NR52 & 0x80) clockSequencer();
+        return;
+    }
     if (addr >= 0xFF30 && addr <= 0xFF3F) {
         wave_ram[addr - 0xFF30] = data;
-        return true;
-    }
-    switch (addr) {
+    }else switch (addr) {
         case (0xFF10):
             NR10 = data;
-            return true;
+            break;
         case (0xFF11):
-            SweepChannel.duty = duty_table[data >> 6];
+            SweepChannel.duty = data >> 6;
             SweepChannel.length_timer = 64 - (data & 0x3F);
-            NR11 = data;
-            return true;
+            break;
         case (0xFF12):
             SweepChannel.direction = (data >> 3) & 1;
             SweepChannel.envelope_period = data & 0x7;
-            SweepChannel.envelope_volume = data >> 4;
+            if (!(data & 0xF8)) SweepChannel.active = false; // DAC off
             NR12 = data;
-            return true;
+            break;
         case (0xFF13):
-            NR13 = data;
-            return true;
+            SweepChannel.current_F = (SweepChannel.current_F & 0x700) | data;
+            break;
         case (0xFF14):
-            if (data & 0x80){
-                SweepChannel.current_F = ((data & 0x7) << 8) | NR13;
-                SweepChannel.active = true;
-
-                if (!(data & 0x40)) SweepChannel.length_timer = 64;
-
-                SweepChannel.phase = 0.0f;
-                SweepChannel.sweep_counter = 0;
-                SweepChannel.envelope_counter = 0;
-                SweepChannel.length_counter = 0;
-            }
-            NR14 = data & 0x7F;
-            return true;
+            SweepChannel.current_F = ((data & 0x7) << 8) | (SweepChannel.current_F & 0xFF);
+            trigger(0, data);
+            break;
         case (0xFF16):
-            BahChannel.duty = duty_table[data >> 6];
+            BahChannel.duty = data >> 6;
             BahChannel.length_timer = 64 - (data & 0x3F);
-            NR21 = data;
-            return true;
+            break;
         case (0xFF17):
             BahChannel.direction = (data >> 3) & 1;
             BahChannel.envelope_period = data & 0x07;
-            BahChannel.envelope_volume = data >> 4;
+            if (!(data & 0xF8)) BahChannel.active = false;
             NR22 = data;
-            return true;
+            break;
         case (0xFF18):
-            NR23 = data;
-            return true;
+            BahChannel.current_F = (BahChannel.current_F & 0x700) | data;
+            break;
         case (0xFF19):
-            if (data & 0x80){
-                BahChannel.current_F = ((data & 0x7) << 8) | NR23;
-                BahChannel.active = true;
-
-                if (!(data & 0x40)) BahChannel.length_timer = 64;
-
-                BahChannel.phase = 0.0f;
-                BahChannel.envelope_counter = 0;
-                BahChannel.length_counter = 0;
-            }
-            NR24 = data & 0x7F;
-            return true;
+            BahChannel.current_F = ((data & 0x7) << 8) | (BahChannel.current_F & 0xFF);
+            trigger(1, data);
+            break;
         case (0xFF1A):
+            if (!(data & 0x80)) WaveChannel.active = false;
             NR30 = data;
-            return true;
+            break;
         case (0xFF1B):
-            WaveChannel.length_timer = 255 - data;
-            NR31 = data;
-            return true;
+            WaveChannel.length_timer = 256 - data;
+            break;
         case (0xFF1C):
-            WaveChannel.envelope_volume = data >> 5;
-            NR32 = data;
-            return true;
+            WaveChannel.envelope_volume = (data >> 5) & 0x3;
+            break;
         case (0xFF1D):
-            NR33 = data;
-            return true;
+            WaveChannel.current_F = (WaveChannel.current_F & 0x700) | data;
+            break;
         case (0xFF1E):
-            if (data & 0x80){
-                WaveChannel.current_F = ((data & 0x07) << 8) | NR33;
-                WaveChannel.active = true;
-
-                if (!(data & 0x40)) WaveChannel.length_timer = 255;
-
-                WaveChannel.phase = 0.f;
-                WaveChannel.length_counter = 0;
-            }
-            NR34 = data & 0x7F;
-            return true;
+            WaveChannel.current_F = ((data & 0x7) << 8) | (WaveChannel.current_F & 0xFF);
+            trigger(2, data);
+            break;
         case (0xFF20):
-            NoiseChannel.length_timer = 128 - (data & 0x3F);
-            NR41 = data;
-            return true;
+            NoiseChannel.length_timer = 64 - (data & 0x3F);
+            break;
         case (0xFF21):
             NoiseChannel.direction = (data >> 3) & 1;
-            NoiseChannel.envelope_volume = (data >> 4) & 0xF;
             NoiseChannel.envelope_period = data & 0x7;
+            if (!(data & 0xF8)) NoiseChannel.active = false;
             NR42 = data;
-            return true;
+            break;
         case (0xFF22):
             NR43 = data;
-            return true;
+            break;
         case (0xFF23):
-            if (data & 0x80){
-                NoiseChannel.current_F = divisor_table[NR43 & 0x07];
-                NoiseChannel.active = true;
-                NoiseChannel.lfsr = 0x7FFF;
-                
-                if (!(data & 0x40)) NoiseChannel.length_timer = 128;
-                
-                NoiseChannel.phase = 0.f;
-                NoiseChannel.envelope_counter = 0;
-                NoiseChannel.length_counter = 0;
-            }
-            NR44 = data & 0x7F;
-            return true;
+            trigger(3, data);
+            break;
         case (0xFF24):
-            leftVolume = (data & 0x7) / 7.0f;
-            rightVolume = ((data >> 4) & 0x7) / 7.0f;
             NR50 = data;
-            return true;
+            updateGains();
+            break;
         case (0xFF25):
             NR51 = data;
-            return true;
+            updateGains();
+            break;
         case (0xFF26):
             if (!(data & 0x80)){
                 SweepChannel.active = false;
                 BahChannel.active = false;
                 WaveChannel.active = false;
+                NoiseChannel.active = false;
+            }else if (!(NR52 & 0x80)){
+                sequencerStep = 0; // powering on restarts the sequence
             }
             NR52 = data;
-            return true;
+            break;
     }
-    return false;
+    for (int i = 0; i < 4; i++) mix(i, time);
+}
+
+bool parseAudioBackend(const char* name, AudioBackend& backend){
+    if (!strcmp(name, "sdl")) backend = AUDIO_SDL;
+    else if (!strcmp(name, "file")) backend = AUDIO_FILE;
+    else if (!strcmp(name, "null")) backend = AUDIO_NULL;
+    else return false;
+    return true;
+}
+
+APU::~APU(){
+    for (int i = 0; i < 4; i++) delete stems[i];
+}
+void APU::setScheduler(Scheduler* master){
+    scheduler = master;
+    scheduleBlock();
+}
+void APU::scheduleBlock(){
+    if (!scheduler) return;
+    if (sink) scheduler->schedule(EVENT_AUDIO, nextBlock);
+    else scheduler->cancel(EVENT_AUDIO);
+}
+void APU::setTimer(Timer* master){
+    timer = master;
 }
+void APU::setSink(AudioSink* output){
+    sink = output;
+    nextBlock = renderer.timeFor(block);
+    scheduleBlock();
+    // sequencer events are only needed by the sound
+    if (timer) timer->scheduleSequencer();
+}
+AudioSink* APU::getSink(){
+    return sink;
+}
+void APU::setStem(int channel, AudioSink* output){
+    delete stems[channel];
+    stems[channel] = nullptr;
+    stemSinks[channel] = output;
+    if (!output) return;
+    stems[channel] = new AudioRenderer();
+    stems[channel]->setMask(1 << channel);
+    stems[channel]->setSampleRate(sampleRate * ratio);
+}
+void APU::setOutput(int rate, int frames){
+    sampleRate = rate;
+    block = std::clamp(frames, 1, AUDIO_BLOCK);
+    renderer.setSampleRate(sampleRate * ratio);
+    for (AudioRenderer* stem : stems) if (stem) stem->setSampleRate(sampleRate * ratio);
+    nextBlock = renderer.timeFor(block);
+    scheduleBlock();
+}
+// Renders the next samples, replaying queued writes at the cycle they
+// happened. Stems get the same chunk straight from their renderers.
+void APU::render(int16_t* buffer, int samples){
+    int frames = samples / 2;
+    for (int done = 0; done < frames;){
+        int chunk = std::min(frames - done, 2048);
+        uint64_t end = renderer.timeFor(chunk);
+        replay(end);
+        renderer.read(buffer + done*2, chunk);
+        for (int i = 0; i < 4; i++){
+            if (!stems[i]) continue;
+            int16_t stemBuffer[2048 * 2];
+            stems[i]->read(stemBuffer, chunk);
+            stemSinks[i]->write(stemBuffer, chunk * 2);
+        }
+        done += chunk;
+    }
+}
+// Applies the queued writes up to until and runs every renderer there
+void APU::replay(uint64_t until){
+    while (!events.empty() && events.front().time <= until){
+        const AudioEvent& event = events.front();
+        renderer.run(event.time);
+        renderer.apply(event.addr, event.data);
+        for (AudioRenderer* stem : stems){
+            if (!stem) continue;
+            stem->run(event.time);
+            stem->apply(event.addr, event.data);
+        }
+        events.pop_front();
+    }
+    renderer.run(until);
+    for (AudioRenderer* stem : stems) if (stem) stem->run(until);
+}
+// Samples go to the sink a block at a time once emulated time has
+// passed the block, the sink then picks the ratio for the next one.
+void APU::update(){
+    while (sink && scheduler->now >= nextBlock){
+        int16_t buffer[AUDIO_BLOCK * 2];
+        render(buffer, block * 2);
+        sink->write(buffer, block * 2);
+        double wanted = sink->rate();
+        if (wanted != ratio){
+            ratio = wanted;
+            renderer.setSampleRate(sampleRate * ratio);
+            for (AudioRenderer* stem : stems) if (stem) stem->setSampleRate(sampleRate * ratio);
+        }
+        nextBlock = renderer.timeFor(block);
+    }
+    scheduleBlock();
+}
+void APU::sequencerTick(uint64_t at){
+    if (sink) events.push_back({at, AUDIO_SEQUENCER, 0});
+}
+void APU::divReset(bool edge){
+    catchUp();
+    if (edge && (NR52 & 0x80)) step(1);
+    stepsSeen = 0;
+}
+// Steps since the last look, none count while the APU is off
+void APU::catchUp(){
+    uint32_t edges = timer ? timer->sequencerEdges() : stepsSeen;
+    uint32_t steps = edges - stepsSeen;
+    stepsSeen = edges;
+    if (NR52 & 0x80) step(steps);
+}
+// Length counters tick on even sequencer steps
+void APU::step(uint32_t steps){
+    // 512 steps run any length counter out, the rest only turn the step
+    if (steps > 512) steps = 512 + steps % 8;
+    const uint8_t* const controls[4] = {&NR14, &NR24, &NR34, &NR44};
+    for (; steps; steps--){
+        bool length = !(sequencerStep & 1);
+        sequencerStep = (sequencerStep + 1) & 7;
+        if (!length) continue;
+        for (int i = 0; i < 4; i++){
+            if (!(*controls[i] & 0x40) || !lengths[i]) continue;
+            if (--lengths[i] == 0) status &= ~(1 << i);
+        }
+    }
+}
+void APU::trigger(int index, uint8_t data){
+    if (!(data & 0x80)) return;
+    const uint8_t* const dacs[4] = {&NR12, &NR22, &NR30, &NR42};
+    bool dac = (index == 2) ? (NR30 & 0x80) : (*dacs[index] & 0xF8);
+    if (dac) status |= 1 << index;
+    if (!lengths[index]) lengths[index] = (index == 2) ? 256 : 64;
+}
+
+// Registers read back right away, the sound itself follows through the
+// event queue so every write is heard at its emulated time.
+bool APU::write(uint16_t addr, uint8_t data){
+    if (addr < 0xFF10 || addr > 0xFF3F) return false;
+    catchUp();
+    if (addr >= 0xFF30 && addr <= 0xFF3F) {
+        wave_ram[addr - 0xFF30] = data;
+    }else switch (addr) {
+        case (0xFF10): NR10 = data; break;
+        case (0xFF11): NR11 = data; lengths[0] = 64 - (data & 0x3F); break;
+        case (0xFF12): NR12 = data; if (!(data & 0xF8)) status &= ~0x01; break;
+        case (0xFF13): NR13 = data; break;
+        case (0xFF14): NR14 = data & 0x7F; trigger(0, data); break;
+        case (0xFF16): NR21 = data; lengths[1] = 64 - (data & 0x3F); break;
+        case (0xFF17): NR22 = data; if (!(data & 0xF8)) status &= ~0x02; break;
+        case (0xFF18): NR23 = data; break;
+        case (0xFF19): NR24 = data & 0x7F; trigger(1, data); break;
+        case (0xFF1A): NR30 = data; if (!(data & 0x80)) status &= ~0x04; break;
+        case (0xFF1B): NR31 = data; lengths[2] = 256 - data; break;
+        case (0xFF1C): NR32 = data; break;
+        case (0xFF1D): NR33 = data; break;
+        case (0xFF1E): NR34 = data & 0x7F; trigger(2, data); break;
+        case (0xFF20): NR41 = data; lengths[3] = 64 - (data & 0x3F); break;
+        case (0xFF21): NR42 = data; if (!(data & 0xF8)) status &= ~0x08; break;
+        case (0xFF22): NR43 = data; break;
+        case (0xFF23): NR44 = data & 0x7F; trigger(3, data); break;
+        case (0xFF24): NR50 = data; break;
+        case (0xFF25): NR51 = data; break;
+        case (0xFF26):
+            if (!(data & 0x80)) status = 0;
+            else if (!(NR52 & 0x80)) sequencerStep = 0;
+            NR52 = data;
+            break;
+        default: return false;
+    }
+    if (sink) events.push_back({scheduler->now, addr, data});
+    return true;
+}
+
 bool APU::read(uint16_t addr, uint8_t& data){
     if (addr > 0xFF3F) return false;
     if (addr >= 0xFF30 && addr <= 0xFF3F) {
@@ -406,8 +552,134 @@ bool APU::read(uint16_t addr, uint8_t& data){
             data = NR51;
             return true;
         case (0xFF26):
-            data = NR52;
+            catchUp();
+            data = (NR52 & 0x80) | status;
             return true;
     }
     return false;
-}
\ No newline at end of file
+}
+void AudioRenderer::restart(uint64_t at){
+    blipLeft.clear();
+    blipRight.clear();
+    time = at;
+    frameStart = at;
+}
+struct RendererSection{
+    uint64_t time;
+    uint64_t frameStart;
+    uint8_t registers[9];
+    uint8_t sequencerStep;
+    uint8_t wave_ram[16];
+    uint8_t reserved[6];
+};
+static_assert(sizeof(RendererSection) == 48, "no padding in sections");
+void AudioRenderer::saveState(StateWriter& state){
+    RendererSection section{time, frameStart,
+        {NR10, NR12, NR22, NR30, NR42, NR43, NR50, NR51, NR52}, sequencerStep, {}, {}};
+    memcpy(section.wave_ram, wave_ram, sizeof(wave_ram));
+    state.begin(STATE_ID('S', 'N', 'D', ' '));
+    state.put(section);
+    for (int i = 0; i < 4; i++) state.put(channel(i));
+    blipLeft.saveState(state);
+    blipRight.saveState(state);
+    state.end();
+}
+bool AudioRenderer::checkState(StateReader& state, uint64_t until, bool timed){
+    RendererSection section;
+    if (!state.begin(STATE_ID('S', 'N', 'D', ' ')) || !state.get(section)) return false;
+    if (timed && (section.time > until || section.frameStart > section.time
+                  || until - section.frameStart > STATE_HORIZON)) return false;
+    uint64_t span = timed ? until - section.frameStart : 0;
+    for (int i = 0; i < 4; i++){
+        Channel ch;
+        // duty table and wave RAM lookups
+        if (!state.get(ch) || ch.duty >= 4 || ch.position >= 32) return false;
+    }
+    return blipLeft.checkState(state, span) && blipRight.checkState(state, span);
+}
+bool AudioRenderer::loadState(StateReader& state){
+    RendererSection section;
+    if (!state.begin(STATE_ID('S', 'N', 'D', ' ')) || !state.get(section)) return false;
+    for (int i = 0; i < 4; i++) if (!state.get(channel(i))) return false;
+    if (!blipLeft.loadState(state) || !blipRight.loadState(state)) return false;
+    time = section.time;
+    frameStart = section.frameStart;
+    NR10 = section.registers[0];
+    NR12 = section.registers[1];
+    NR22 = section.registers[2];
+    NR30 = section.registers[3];
+    NR42 = section.registers[4];
+    NR43 = section.registers[5];
+    NR50 = section.registers[6];
+    NR51 = section.registers[7];
+    NR52 = section.registers[8];
+    sequencerStep = section.sequencerStep;
+    memcpy(wave_ram, section.wave_ram, sizeof(wave_ram));
+    updateGains();
+    return true;
+}
+
+static uint8_t APU::* const registers[21] = {
+    &APU::NR52, &APU::NR10, &APU::NR11, &APU::NR12, &APU::NR13, &APU::NR14,
+    &APU::NR21, &APU::NR22, &APU::NR23, &APU::NR24,
+    &APU::NR30, &APU::NR31, &APU::NR32, &APU::NR33, &APU::NR34,
+    &APU::NR41, &APU::NR42, &APU::NR43, &APU::NR44, &APU::NR50, &APU::NR51
+};
+struct APUSection{
+    uint64_t nextBlock;
+    int32_t lengths[4];
+    uint32_t stepsSeen;
+    uint8_t registers[21];
+    uint8_t wave_ram[16];
+    uint8_t status;
+    uint8_t sequencerStep;
+    uint8_t rendered; // the renderer was following the registers
+    uint8_t reserved[4];
+};
+static_assert(sizeof(APUSection) == 72, "no padding in sections");
+void APU::saveState(StateWriter& state){
+    if (sink) replay(scheduler->now);
+    APUSection section{nextBlock, {}, stepsSeen, {}, {}, status, sequencerStep,
+                       sink != nullptr, {}};
+    for (int i = 0; i < 4; i++) section.lengths[i] = lengths[i];
+    for (int i = 0; i < 21; i++) section.registers[i] = this->*registers[i];
+    memcpy(section.wave_ram, wave_ram, sizeof(wave_ram));
+    state.begin(STATE_ID('A', 'P', 'U', ' '));
+    state.put(section);
+    state.end();
+    renderer.saveState(state);
+}
+bool APU::checkState(StateReader& state, uint64_t now){
+    APUSection section;
+    if (!state.begin(STATE_ID('A', 'P', 'U', ' ')) || !state.get(section)) return false;
+    // renderer times only count if it was following the registers
+    bool timed = section.rendered;
+    if (timed && (section.nextBlock < now || section.nextBlock - now > STATE_HORIZON))
+        return false;
+    return renderer.checkState(state, section.nextBlock, timed);
+}
+bool APU::loadState(StateReader& state){
+    APUSection section;
+    if (!state.begin(STATE_ID('A', 'P', 'U', ' ')) || !state.get(section)
+        || !renderer.loadState(state)) return false;
+    for (int i = 0; i < 4; i++) lengths[i] = section.lengths[i];
+    for (int i = 0; i < 21; i++) this->*registers[i] = section.registers[i];
+    memcpy(wave_ram, section.wave_ram, sizeof(wave_ram));
+    stepsSeen = section.stepsSeen;
+    status = section.status;
+    sequencerStep = section.sequencerStep;
+    nextBlock = section.nextBlock;
+    // writes queued before the load belong to the old timeline
+    events.clear();
+    if (!section.rendered){
+        renderer.restart(scheduler->now);
+        nextBlock = renderer.timeFor(block);
+    }
+    for (int i = 0; i < 4; i++){
+        if (!stems[i]) continue;
+        *stems[i] = renderer;
+        stems[i]->setMask(1 << i);
+    }
+    scheduleBlock();
+    return true;
+}
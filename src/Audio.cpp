@@ -0,0 +1,89 @@
+#include <algorithm>
+#include <iostream>
+#include <SDL2/SDL.h>
+
+#include "../include/Audio.hpp"
+
+static void audioCallback(void* userdata, Uint8* stream, int len) {
+    AudioRing* ring = static_cast<AudioRing*>(userdata);
+    ring->pull(reinterpret_cast<int16_t*>(stream), len / sizeof(int16_t));
+}
+static int targetFor(const AudioConfig& config){
+    if (config.latency > 0) return config.sampleRate * config.latency / 1000 * 2;
+    return config.bufferSize * 2 * 2;
+}
+AudioDevice::AudioDevice(APU& apu, SyncMode sync, const AudioConfig& config) :
+apu(apu), sync(sync), queue(config.queue), ring(targetFor(config), config.bufferSize * 2, sync == SYNC_AUDIO),
+stretch(config.stretch)
+{
+    spec.freq = config.sampleRate;
+    spec.format = AUDIO_S16SYS;
+    spec.channels = 2;
+    spec.samples = config.bufferSize;
+    spec.callback = queue ? nullptr : audioCallback;
+    spec.userdata = &ring;
+    // only the SDL backend brings up SDL audio
+    device = 0;
+    if (SDL_InitSubSystem(SDL_INIT_AUDIO) == 0){
+        device = SDL_OpenAudioDevice(nullptr, 0, &spec, nullptr, 0);
+    }else std::cerr << "Error starting SDL audio: " << SDL_GetError() << "\n";
+
+    // blocks no bigger than half the device buffer reach it in time
+    apu.setOutput(config.sampleRate, config.bufferSize / 2);
+    apu.setSink(this);
+    SDL_PauseAudioDevice(device, 0);
+}
+AudioDevice::~AudioDevice(){
+    if (device) SDL_CloseAudioDevice(device);
+    SDL_QuitSubSystem(SDL_INIT_AUDIO);
+    apu.setSink(nullptr);
+}
+void AudioDevice::write(const int16_t* samples, int count){
+    if (!device) return;
+    if (speed != 1.0){
+        if (!stretch || speed < STRETCH_MIN || speed > STRETCH_MAX) return;
+        stretched.clear();
+        stretcher.process(samples, count, stretched);
+        samples = stretched.data();
+        count = stretched.size();
+        if (!count) return;
+    }
+    if (!queue){
+        ring.write(samples, count);
+        return;
+    }
+    while (sync == SYNC_AUDIO && fill() > ring.target){
+        SDL_Delay(1);
+    }
+    if (started && fill() == 0) underruns++;
+    SDL_QueueAudio(device, samples, count * sizeof(int16_t));
+    started = true;
+}
+void AudioDevice::setSpeed(double value){
+    if (value == speed) return;
+    speed = value;
+    stretcher.clear();
+    stretcher.setSpeed(speed);
+}
+double AudioDevice::rate(){
+    if (!queue) return ring.rate();
+    if (sync == SYNC_AUDIO) return 1.0;
+    ring.ratio = rateControl(fill(), ring.target);
+    return ring.ratio;
+}
+int AudioDevice::fill(){
+    if (queue) return SDL_GetQueuedAudioSize(device) / sizeof(int16_t);
+    return ring.fill();
+}
+int AudioDevice::target(){
+    return ring.target;
+}
+double AudioDevice::ratio(){
+    return ring.ratio;
+}
+uint32_t AudioDevice::underrunCount(){
+    return queue ? underruns : ring.underruns.load();
+}
+uint32_t AudioDevice::overrunCount(){
+    return ring.overruns;
+}
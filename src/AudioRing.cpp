@@ -0,0 +1,43 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+#include "../include/AudioRing.hpp"
+
+double rateControl(int fill, int target){
+    double error = double(target - fill) / target;
+    return 1.0 + MAX_RATE_DELTA * std::clamp(error, -1.0, 1.0);
+}
+
+AudioRing::AudioRing(int target, int pull, bool blocking) :
+ring(std::max(target, pull) + 2 * pull), blocking(blocking), target(target)
+{
+    // less than one pull ahead and every callback comes up short
+    if (target < pull){
+        std::cerr << "audio latency below one device buffer, raised to " << pull / 2 << " frames\n";
+        this->target = pull;
+    }
+}
+void AudioRing::write(const int16_t* samples, int count){
+    while (blocking && fill() > target){
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    uint32_t pushed = ring.push(samples, count);
+    if (pushed < uint32_t(count)) overruns += (count - pushed) / 2;
+}
+double AudioRing::rate(){
+    if (blocking) return 1.0;
+    ratio = rateControl(fill(), target);
+    return ratio;
+}
+void AudioRing::pull(int16_t* out, int count){
+    int read = ring.pop(out, count);
+    if (read < count){
+        underruns++;
+        std::fill(out + read, out + count, 0);
+    }
+}
+int AudioRing::fill(){
+    return ring.size();
+}
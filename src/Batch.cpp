@@ -0,0 +1,216 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#include "../include/Batch.hpp"
+#include "../include/Headless.hpp"
+#include "../include/GameBoy.hpp"
+#include "../include/Script.hpp"
+
+bool readJobs(const char* filename, std::vector<BatchJob>& jobs){
+    std::ifstream file(filename);
+    if (!file.is_open()) {
+        std::cerr << "Error opening " << filename << "\n";
+        return false;
+    }
+    std::string line;
+    for (int number = 1; std::getline(file, line); number++){
+        line = line.substr(0, line.find('#'));
+        std::istringstream words(line);
+        BatchJob job;
+        if (!(words >> job.rom)) continue;
+        if (!(words >> job.frames)){
+            std::cerr << filename << ":" << number << ": missing frame count\n";
+            return false;
+        }
+        std::string word;
+        while (words >> word){
+            size_t equals = word.find('=');
+            std::string key = word.substr(0, equals);
+            std::string value = equals == std::string::npos ? "" : word.substr(equals + 1);
+            if (key == "input") job.input = value;
+            else if (key == "hashes") job.hashes = value;
+            else if (key == "golden") job.golden = value;
+            else if (key == "frame") job.frame = value;
+            else if (key == "audio") job.audio = value;
+            else{
+                std::cerr << filename << ":" << number << ": unknown output " << word << "\n";
+                return false;
+            }
+        }
+        jobs.push_back(job);
+    }
+    return true;
+}
+
+struct BatchMachine{
+    Framebuffer screen;
+    GameBoy GB{screen};
+};
+static void runJob(BatchJob& job, const RomImage& image){
+    auto begin = std::chrono::steady_clock::now();
+    InputScript script;
+    std::vector<std::pair<uint32_t, uint64_t>> expected;
+    std::ofstream log;
+    AudioFile audio;
+    BatchMachine* machine = new BatchMachine;
+    GameBoy& GB = machine->GB;
+    GB.MEM.verbose = false;
+    GB.MEM.saveFile = false;
+
+    job.failed = !GB.MEM.load(image)
+        || (!job.input.empty() && !script.load(job.input.c_str()))
+        || (!job.golden.empty() && !readHashes(job.golden.c_str(), expected))
+        || (!job.audio.empty() && !audio.open(job.audio.c_str(), SAMPLE_RATE));
+    if (!job.hashes.empty() && !job.failed){
+        log.open(job.hashes);
+        job.failed = !log;
+        if (!log) std::cerr << "Error writing " << job.hashes << "\n";
+    }
+    if (!job.failed){
+        if (!job.audio.empty()) GB.AP.setSink(&audio);
+        GB.AP.setOutput(SAMPLE_RATE, AUDIO_BLOCK);
+        GB.GC.hashFrames = !job.hashes.empty() || !job.golden.empty();
+        GB.init();
+        size_t check = 0;
+        for (uint32_t i = 0; i < job.frames; i++){
+            script.apply(i, machine->screen.joypad);
+            GB.runFrame();
+            job.ran++;
+
+            uint64_t hash = GB.GC.frameHash;
+            if (log.is_open()){
+                char line[32];
+                snprintf(line, sizeof(line), "%u %016llx\n", i, (unsigned long long)hash);
+                log << line;
+            }
+            while (check < expected.size() && expected[check].first < i) check++;
+            if (check < expected.size() && expected[check].first == i){
+                job.mismatch = job.mismatch || expected[check].second != hash;
+                check++;
+            }
+        }
+        if (!job.frame.empty()) job.failed = !writePPM(job.frame.c_str(), machine->screen.pixels, SCW);
+    }
+    delete machine;
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+    job.seconds = elapsed.count();
+}
+
+// Every worker starts with its own run of the job list. It works from
+// the back of it and, once out, steals from the front of another's.
+struct JobQueue{
+    std::mutex lock;
+    std::deque<int> jobs;
+};
+static bool takeJob(JobQueue* queues, int count, int self, int& job){
+    for (int i = 0; i < count; i++){
+        JobQueue& queue = queues[(self + i) % count];
+        std::lock_guard<std::mutex> guard(queue.lock);
+        if (queue.jobs.empty()) continue;
+        if (i == 0){
+            job = queue.jobs.back();
+            queue.jobs.pop_back();
+        }else{
+            job = queue.jobs.front();
+            queue.jobs.pop_front();
+        }
+        return true;
+    }
+    return false;
+}
+
+int runBatch(int args, char* argv[]){
+    const char* list = nullptr;
+    int threads = 0;
+    bool quiet = false;
+    for (int i = 1; i < args; i++){
+        std::string arg = argv[i];
+        if (arg == "--threads" && i + 1 < args){
+            threads = atoi(argv[++i]);
+        }else if (arg == "--quiet"){
+            quiet = true;
+        }else list = argv[i];
+    }
+    if (!list){
+        std::cerr << "usage: " << argv[0] << " [--threads N] [--quiet] jobs.txt\n";
+        return 1;
+    }
+    std::vector<BatchJob> jobs;
+    if (!readJobs(list, jobs)) return 1;
+    if (threads <= 0) threads = std::thread::hardware_concurrency();
+    if (threads <= 0) threads = 1;
+    if (threads > int(jobs.size())) threads = std::max<int>(jobs.size(), 1);
+
+    // each cartridge is read once, whatever the number of jobs using it;
+    // one that does not read fails its jobs and the rest still run
+    std::map<std::string, RomImage*> images;
+    std::vector<int> runnable;
+    for (size_t i = 0; i < jobs.size(); i++){
+        BatchJob& job = jobs[i];
+        auto found = images.find(job.rom);
+        if (found == images.end()){
+            RomImage* image = new RomImage;
+            if (!image->readFromFile(job.rom.c_str())){
+                delete image;
+                image = nullptr;
+            }
+            found = images.emplace(job.rom, image).first;
+        }
+        if (found->second) runnable.push_back(i);
+        else job.failed = true;
+    }
+
+    JobQueue* queues = new JobQueue[threads];
+    for (size_t i = 0; i < runnable.size(); i++){
+        queues[i * threads / runnable.size()].jobs.push_back(runnable[i]);
+    }
+    auto begin = std::chrono::steady_clock::now();
+    auto work = [&](int self){
+        int index;
+        while (takeJob(queues, threads, self, index)){
+            runJob(jobs[index], *images[jobs[index].rom]);
+        }
+    };
+    std::vector<std::thread> workers;
+    for (int i = 1; i < threads; i++) workers.emplace_back(work, i);
+    work(0);
+    for (auto& worker : workers) worker.join();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+    delete[] queues;
+    for (auto& image : images) delete image.second;
+
+    uint64_t frames = 0;
+    int failed = 0;
+    int mismatched = 0;
+    for (size_t i = 0; i < jobs.size(); i++){
+        const BatchJob& job = jobs[i];
+        failed += job.failed;
+        mismatched += job.mismatch;
+        frames += job.ran;
+        if (quiet) continue;
+        char line[256];
+        if (job.ran && job.seconds > 0){
+            snprintf(line, sizeof(line), "job %zu: %s, %u frames, %.3f s, %.0f fps%s", i,
+                     job.rom.c_str(), job.ran, job.seconds, job.ran / job.seconds,
+                     job.failed ? ", failed" : job.mismatch ? ", golden mismatch" : "");
+        }else snprintf(line, sizeof(line), "job %zu: %s, not run%s", i, job.rom.c_str(),
+                       job.failed ? ", failed" : "");
+        std::cout << line << "\n";
+    }
+    std::cout << "jobs: " << jobs.size() << " on " << threads << " threads\n";
+    std::cout << "frames: " << frames << "\n";
+    std::cout << "time: " << elapsed.count() << " s\n";
+    std::cout << "fps: " << (elapsed.count() > 0 ? frames / elapsed.count() : 0) << "\n";
+    if (failed) std::cout << "failed: " << failed << "\n";
+    if (mismatched) std::cout << "golden mismatches: " << mismatched << "\n";
+    return failed ? 1 : mismatched ? 2 : 0;
+}
@@ -0,0 +1,103 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "../include/Blip.hpp"
+
+#define KERNEL_UNIT 4096 // every phase of the kernel sums to this
+#define BASS_SHIFT 9     // high-pass around 15 Hz at 48 kHz, removes DC
+
+// Blackman windowed sinc impulse for every sub-sample phase, cut off a
+// little below Nyquist
+struct BlipKernel{
+    int16_t taps[BLIP_PHASES][BLIP_TAPS];
+
+    BlipKernel(){
+        const double pi = 3.14159265358979323846;
+        const double cutoff = 0.9;
+        for (int phase = 0; phase < BLIP_PHASES; phase++){
+            double weights[BLIP_TAPS];
+            double sum = 0;
+            for (int n = 0; n < BLIP_TAPS; n++){
+                double x = n - (BLIP_TAPS/2 - 1) - double(phase) / BLIP_PHASES;
+                double sinc = (x == 0) ? 1.0 : std::sin(pi * cutoff * x) / (pi * cutoff * x);
+                double window = 0.42 + 0.5 * std::cos(pi * x / (BLIP_TAPS/2)) +
+                                0.08 * std::cos(2 * pi * x / (BLIP_TAPS/2));
+                weights[n] = sinc * std::max(window, 0.0);
+                sum += weights[n];
+            }
+            int total = 0;
+            for (int n = 0; n < BLIP_TAPS; n++){
+                taps[phase][n] = int16_t(std::lround(weights[n] * KERNEL_UNIT / sum));
+                total += taps[phase][n];
+            }
+            // rounding error goes into the tallest tap, steps stay exact
+            int center = BLIP_TAPS/2 - 1 + (phase >= BLIP_PHASES/2);
+            taps[phase][center] += KERNEL_UNIT - total;
+        }
+    }
+};
+static const BlipKernel& kernel(){
+    static BlipKernel table;
+    return table;
+}
+
+BlipBuffer::BlipBuffer() : buffer(BLIP_CAPACITY + BLIP_TAPS)
+{ }
+void BlipBuffer::setRates(double clockRate, double sampleRate){
+    factor = uint64_t(std::ceil(sampleRate / clockRate * 4294967296.0));
+}
+void BlipBuffer::clear(){
+    offset = 0;
+    integrator = 0;
+    std::fill(buffer.begin(), buffer.end(), 0);
+}
+void BlipBuffer::addDelta(uint32_t time, int delta){
+    uint64_t fixed = offset + time * factor;
+    int32_t* out = buffer.data() + (fixed >> 32);
+    const int16_t* taps = kernel().taps[(fixed >> (32 - 5)) & (BLIP_PHASES - 1)];
+    for (int n = 0; n < BLIP_TAPS; n++) out[n] += taps[n] * delta;
+}
+uint32_t BlipBuffer::clocksNeeded(int samples){
+    uint64_t needed = (uint64_t(samples) << 32) - std::min(offset, uint64_t(samples) << 32);
+    return uint32_t((needed + factor - 1) / factor);
+}
+void BlipBuffer::endFrame(uint32_t time){
+    offset += time * factor;
+}
+int BlipBuffer::samplesAvail(){
+    return offset >> 32;
+}
+int BlipBuffer::read(int16_t* out, int count, int stride){
+    count = std::min(count, samplesAvail());
+    int32_t sum = integrator;
+    for (int i = 0; i < count; i++){
+        sum += buffer[i];
+        int32_t sample = sum / KERNEL_UNIT;
+        out[i * stride] = int16_t(std::clamp(sample, -32768, 32767));
+        sum -= sum >> BASS_SHIFT;
+    }
+    integrator = sum;
+    int remain = samplesAvail() + BLIP_TAPS - count;
+    memmove(buffer.data(), buffer.data() + count, remain * sizeof(int32_t));
+    std::fill(buffer.begin() + remain, buffer.begin() + remain + count, 0);
+    offset -= uint64_t(count) << 32;
+    return count;
+}
+void BlipBuffer::saveState(StateWriter& state){
+    state.put(offset);
+    state.put(integrator);
+    state.put(buffer.data(), buffer.size() * sizeof(int32_t));
+}
+// Deltas land at the offset plus the time in the frame, they have to
+// stay inside the buffer
+bool BlipBuffer::checkState(StateReader& state, uint64_t clocks){
+    uint64_t at;
+    return state.get(at) && (at >> 32) < BLIP_CAPACITY
+        && ((at + clocks * factor) >> 32) < BLIP_CAPACITY
+        && state.skip(sizeof(integrator) + buffer.size() * sizeof(int32_t));
+}
+bool BlipBuffer::loadState(StateReader& state){
+    return state.get(offset) && state.get(integrator)
+        && state.get(buffer.data(), buffer.size() * sizeof(int32_t));
+}
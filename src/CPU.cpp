@@ -301,7 +301,7 @@ void CPU::STOP(){
     }
     if (ime) halt = true;
 }
-CPU::CPU(MemoryMaster& master) : MEM(master){}
+CPU::CPU(MemoryMaster& master) : MEM(master), IS(master.IS){}
 void CPU::init(){
     MEM.write(0xFF40, 0x91);  // LCDC
 
@@ -660,4 +660,42 @@ int CPU::step(){
         if (doubleSpeed) execute(n());
     }else time += 4;
     return time + extraTime;
-}
\ No newline at end of file
+}
+bool CPU::sleeping(){
+    return halt && !(IS.IE & IS.IF);
+}
+struct CPUSection{
+    uint16_t PC;
+    uint16_t SP;
+    uint8_t A, F, B, C, D, E, H, L;
+    uint8_t halt;
+    uint8_t ime;
+    uint8_t doubleSpeed;
+    uint8_t extraTime;
+};
+static_assert(sizeof(CPUSection) == 16, "no padding in sections");
+void CPU::saveState(StateWriter& state){
+    CPUSection section{PC, SP, A, F, B, C, D, E, H, L, halt, ime, doubleSpeed, extraTime};
+    state.begin(STATE_ID('C', 'P', 'U', ' '));
+    state.put(section);
+    state.end();
+}
+bool CPU::loadState(StateReader& state){
+    CPUSection section;
+    if (!state.begin(STATE_ID('C', 'P', 'U', ' ')) || !state.get(section)) return false;
+    PC = section.PC;
+    SP = section.SP;
+    A = section.A;
+    F = section.F;
+    B = section.B;
+    C = section.C;
+    D = section.D;
+    E = section.E;
+    H = section.H;
+    L = section.L;
+    halt = section.halt;
+    ime = section.ime;
+    doubleSpeed = section.doubleSpeed;
+    extraTime = section.extraTime;
+    return true;
+}
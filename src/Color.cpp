@@ -0,0 +1,80 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "../include/Color.hpp"
+
+static uint32_t rgba(double r, double g, double b){
+    auto channel = [](double v) {
+        return uint32_t(std::lround(std::clamp(v, 0.0, 1.0) * 255.0));
+    };
+    return (channel(r) << 24) | (channel(g) << 16) | (channel(b) << 8) | 0xFF;
+}
+// r, g, b in 0..1
+static uint32_t convert(ColorMode mode, double r, double g, double b){
+    switch (mode) {
+        case COLOR_LCD:
+            return rgba((r*13 + g*2 + b) / 16,
+                        (g*3 + b) / 4,
+                        (r*3 + g*2 + b*11) / 16);
+        case COLOR_GAMMA:{
+            r = std::pow(r, 4.0);
+            g = std::pow(g, 4.0);
+            b = std::pow(b, 4.0);
+            double scale = 255.0 / 280.0;
+            return rgba(std::pow((g*50 + r*255) / 255, 1 / 2.2) * scale,
+                        std::pow((b*30 + g*230 + r*10) / 255, 1 / 2.2) * scale,
+                        std::pow((b*220 + g*10 + r*50) / 255, 1 / 2.2) * scale);
+        }
+        default:
+            return rgba(r, g, b);
+    }
+}
+
+struct ColorTables{
+    uint32_t cgb[0x8000];
+    uint32_t dmg[4];
+
+    ColorTables(ColorMode mode){
+        for (uint32_t data = 0; data < 0x8000; data++){
+            uint8_t r = (data & 0x1F);
+            uint8_t g = (data >> 5) & 0x1F;
+            uint8_t b = (data >> 10) & 0x1F;
+            if (mode == COLOR_RAW){
+                r = (r << 3) | (r >> 2);
+                g = (g << 3) | (g >> 2);
+                b = (b << 3) | (b >> 2);
+                cgb[data] = (r<< 24) | (g << 16) | (b << 8) | 0xFF;
+            }else cgb[data] = convert(mode, r / 31.0, g / 31.0, b / 31.0);
+        }
+        static const double levels[4] = {1.0, 2.0/3, 1.0/3, 0.0};
+        for (int i = 0; i < 4; i++){
+            dmg[i] = convert(mode, levels[i], levels[i], levels[i]);
+        }
+    }
+};
+static const ColorTables& tables(ColorMode mode){
+    static const ColorTables raw(COLOR_RAW);
+    if (mode == COLOR_LCD){
+        static const ColorTables lcd(COLOR_LCD);
+        return lcd;
+    }
+    if (mode == COLOR_GAMMA){
+        static const ColorTables gamma(COLOR_GAMMA);
+        return gamma;
+    }
+    return raw;
+}
+const uint32_t* colorTable(ColorMode mode){
+    return tables(mode).cgb;
+}
+const uint32_t* shadeTable(ColorMode mode){
+    return tables(mode).dmg;
+}
+bool parseColorMode(const char* name, ColorMode& mode){
+    if (!strcmp(name, "raw")) mode = COLOR_RAW;
+    else if (!strcmp(name, "lcd")) mode = COLOR_LCD;
+    else if (!strcmp(name, "gamma")) mode = COLOR_GAMMA;
+    else return false;
+    return true;
+}
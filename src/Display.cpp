@@ -1,11 +1,16 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
 #include "../include/Display.hpp"
 #include "../include/MEM.hpp"
+#include "../include/Audio.hpp"
 #include <SDL2/SDL.h>
 
 Window::Window(unsigned int width, unsigned int height, const char* name)
 {
     dst = {0, 0, int(width), int(height)};
-    SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTS  | SDL_INIT_AUDIO);
+    SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTS);
     
     window = SDL_CreateWindow(name, SDL_WINDOWPOS_CENTERED,
         SDL_WINDOWPOS_CENTERED, width, height,
@@ -13,19 +18,30 @@ Window::Window(unsigned int width, unsigned int height, const char* name)
 
     renderer = SDL_CreateRenderer(window, -1,
         SDL_RENDERER_ACCELERATED);
-    
-    texture = SDL_CreateTexture(renderer,
-        SDL_PIXELFORMAT_RGBA8888,
-        SDL_TEXTUREACCESS_STREAMING,
-        SCW, SCH);
 
-    display = new uint32_t[SCW*SCH];
+    SDL_DisplayMode mode;
+    int rate = 60;
+    if (SDL_GetWindowDisplayMode(window, &mode) == 0 && mode.refresh_rate > 0) rate = mode.refresh_rate;
+    refresh = SDL_GetPerformanceFrequency() / rate;
+    
+    scratch = new uint32_t[SCW*SCH];
     for (unsigned int i = 0; i < SCW*SCH; i++)
-        display[i] = 0xFFFFFFFF;
+        scratch[i] = 0xFFFFFFFF;
+
+    for (int i = 0; i < 2; i++){
+        textures[i] = SDL_CreateTexture(renderer,
+            SDL_PIXELFORMAT_RGBA8888,
+            SDL_TEXTUREACCESS_STREAMING,
+            SCW, SCH);
+        SDL_UpdateTexture(textures[i], NULL, scratch, SCW * sizeof(uint32_t));
+    }
 };
 Window::~Window() {
-    delete[] display;
-    SDL_DestroyTexture(texture);
+    if (locked) SDL_UnlockTexture(textures[back]);
+    delete scaler;
+    delete[] scratch;
+    SDL_DestroyTexture(textures[0]);
+    SDL_DestroyTexture(textures[1]);
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
     SDL_Quit();
@@ -79,6 +95,16 @@ void Window::poolEvents() {
                         joypad.buttons &= ~0x1; break;
                     case(SDLK_c):
                         joypad.buttons &= ~0xF; break;
+                    case(SDLK_r):
+                        rewinding = true; break;
+                    case(SDLK_TAB):
+                        turbo = true; break;
+                    case(SDLK_MINUS):
+                        if (!event.key.repeat) stepSpeed(-1);
+                        break;
+                    case(SDLK_EQUALS):
+                        if (!event.key.repeat) stepSpeed(1);
+                        break;
                     default:
                         break;
                 }
@@ -104,6 +130,10 @@ void Window::poolEvents() {
                         joypad.buttons |= 0x1; break;
                     case(SDLK_c):
                         joypad.buttons |= 0xF; break;
+                    case(SDLK_r):
+                        rewinding = false; break;
+                    case(SDLK_TAB):
+                        turbo = false; break;
                     default:
                         break;
                 }
@@ -137,38 +167,149 @@ bool Window::poolFile(MemoryMaster& master) {
     }
     return false;
 }
-static constexpr int FRAME_DELAY = 1000 / 60;
-void Window::show(){
-    SDL_UpdateTexture(texture, NULL, display, SCW * sizeof(uint32_t));
+void Window::setFilter(ScaleFilter filter, int factor, int threads){
+    if (locked) SDL_UnlockTexture(textures[back]);
+    locked = false;
+    delete scaler;
+    scaler = new Upscaler(filter, factor, threads);
 
+    int width = SCW * scaler->scaleFactor();
+    int height = SCH * scaler->scaleFactor();
+    uint32_t* white = new uint32_t[width*height];
+    for (int i = 0; i < width*height; i++)
+        white[i] = 0xFFFFFFFF;
+    for (int i = 0; i < 2; i++){
+        SDL_DestroyTexture(textures[i]);
+        textures[i] = SDL_CreateTexture(renderer,
+            SDL_PIXELFORMAT_RGBA8888,
+            SDL_TEXTUREACCESS_STREAMING,
+            width, height);
+        SDL_UpdateTexture(textures[i], NULL, white, width * sizeof(uint32_t));
+    }
+    delete[] white;
+}
+// Returns write-only memory of the back texture, pitch is in pixels.
+// Stays locked until the next show().
+uint32_t* Window::lockFrame(int& pitch){
+    if (scaler){
+        pitch = SCW;
+        return scratch;
+    }
+    if (locked) SDL_UnlockTexture(textures[back]);
+
+    void* pixels;
+    int bytes;
+    if (SDL_LockTexture(textures[back], NULL, &pixels, &bytes) != 0){
+        locked = false;
+        pitch = SCW;
+        return scratch;
+    }
+    locked = true;
+    pitch = bytes / sizeof(uint32_t);
+    return static_cast<uint32_t*>(pixels);
+}
+void Window::setSync(SyncMode mode){
+    sync = mode;
+    nextFrame = 0;
+}
+void Window::setSpeed(double value, double turboValue){
+    speed = value > 0 ? std::max(value, 0.25) : 0;
+    turboSpeed = turboValue > 0 ? std::max(turboValue, 0.25) : 0;
+}
+void Window::setAudio(AudioDevice* device){
+    audio = device;
+}
+// - and = walk through these, unlimited last
+void Window::stepSpeed(int direction){
+    static const double steps[] = {0.25, 0.5, 1, 2, 4, 0};
+    const int count = sizeof(steps) / sizeof(steps[0]);
+    int at = 0;
+    while (at < count - 1 && steps[at] != speed && (speed == 0 || steps[at] < speed)) at++;
+    speed = steps[std::clamp(at + direction, 0, count - 1)];
+}
+// Achieved speed in the top left corner, in a 3x5 pixel font
+void Window::drawSpeed(){
+    static const uint16_t glyphs[12] = {
+        0x7B6F, 0x2C97, 0x73E7, 0x73CF, 0x5BC9, 0x79CF, 0x79EF, 0x7249, 0x7BEF, 0x7BCF,
+        0x0002, 0x0AA8 // . x
+    };
+    char text[16];
+    snprintf(text, sizeof(text), achieved < 100 ? "%.1fx" : "%.0fx", achieved);
+    int length = strlen(text);
+    int size = std::max(1, dst.w / SCW);
+    SDL_Rect box{dst.x + size, dst.y + size, (length*4 + 1) * size, 7 * size};
     SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-    SDL_RenderClear(renderer);
+    SDL_RenderFillRect(renderer, &box);
+    SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+    for (int n = 0; n < length; n++){
+        int glyph = text[n] == '.' ? 10 : text[n] == 'x' ? 11 : text[n] - '0';
+        for (int bit = 0; bit < 15; bit++){
+            if (!((glyphs[glyph] >> (14 - bit)) & 1)) continue;
+            SDL_Rect pixel{box.x + (1 + n*4 + bit % 3) * size, box.y + (1 + bit / 3) * size, size, size};
+            SDL_RenderFillRect(renderer, &pixel);
+        }
+    }
+}
+void Window::show(){
+    Uint64 frequency = SDL_GetPerformanceFrequency();
+    Uint64 now = SDL_GetPerformanceCounter();
+    double target = turbo ? turboSpeed : speed;
+    if (audio) audio->setSpeed(target);
+    if (!measureStart) measureStart = now;
+    measureFrames++;
+    if (now - measureStart >= frequency / 2){
+        achieved = measureFrames * double(FRAME_CYCLES) / CPU_CLOCK * frequency / (now - measureStart);
+        measureStart = now;
+        measureFrames = 0;
+    }
+    // Faster than real time a frame is only presented once the display
+    // is ready for the next one, and one that would not be is not drawn
+    bool decoupled = target == 0 || target > 1;
+    bool drawn = !dropNext;
+    bool present = drawn && (!decoupled || now >= nextPresent);
+    Uint64 cost = lastShow ? now - lastShow : 0;
+    lastShow = now;
 
-    SDL_RenderCopy(renderer, texture, NULL, &dst);
+    if (scaler && drawn){
+        void* pixels;
+        int bytes;
+        if (SDL_LockTexture(textures[back], NULL, &pixels, &bytes) == 0){
+            scaler->scale(scratch, SCW, static_cast<uint32_t*>(pixels), bytes / sizeof(uint32_t));
+            locked = true;
+        }
+    }
+    if (locked){
+        SDL_UnlockTexture(textures[back]);
+        locked = false;
+        back ^= 1;
+    }
+    if (present){
+        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+        SDL_RenderClear(renderer);
 
-    SDL_RenderPresent(renderer);
+        SDL_RenderCopy(renderer, textures[back ^ 1], NULL, &dst);
+        if (target != 1) drawSpeed();
 
-    static Uint32 lastTime = SDL_GetTicks();
+        SDL_RenderPresent(renderer);
+        nextPresent = now + refresh;
+    }
+    dropNext = decoupled && now + cost < nextPresent;
 
-    Uint32 currentTime = SDL_GetTicks();
-    Uint32 frameTime = currentTime - lastTime;
-    
-    if (frameTime < FRAME_DELAY) {
-        SDL_Delay(FRAME_DELAY - frameTime);
+    if (target != paced){
+        paced = target;
+        nextFrame = 0;
     }
-    
-    lastTime = SDL_GetTicks(); 
-}
-const uint32_t col[4] = {0xFFFFFFFF, 0xAAAAAAFF, 0x555555FF, 0x000000FF};
-void Window::drawLine(uint8_t* lines, uint8_t y){
-    int dy = y * SCW;
-    for (int x = 0; x < 160; x++) {
-        int adr = dy + x;
-        display[adr] = col[lines[x]];
+    if (target == 0 || (sync != SYNC_VIDEO && target == 1)) return;
+    // Paced at speed times the real frame rate (~59.73 Hz), the audio
+    // side resamples to match. Away from real time audio cannot pace, so
+    // this does even when synced to audio. After a long stall the
+    // schedule restarts instead of rushing to catch up.
+    Uint64 period = frequency * FRAME_CYCLES / CPU_CLOCK / target;
+    now = SDL_GetPerformanceCounter();
+    if (!nextFrame || now > nextFrame + period * 4) nextFrame = now;
+    nextFrame += period;
+    if (nextFrame > now) {
+        SDL_Delay((nextFrame - now) * 1000 / frequency);
     }
 }
-void Window::setPixel(uint8_t x, int dy, uint32_t color){
-    int idx = dy + x;
-    display[idx] = color;
-}
 bool Window::isOpen() { return !shouldClose; }
@@ -0,0 +1,119 @@
+#include <cstring>
+
+#include "../include/GameBoy.hpp"
+#include "../include/Rewind.hpp"
+#include "../include/RunAhead.hpp"
+
+GameBoy::GameBoy(Screen& screen) : context(screen), GB(MEM),
+GC(MEM, screen)
+{
+    MEM.setTimer(&timer);
+    MEM.setJoypad(&context.joypad);
+    MEM.setPPU(&GC);
+    MEM.setAPU(&AP);
+    MEM.setSerial(&serial);
+    timer.setAPU(&AP);
+    AP.setTimer(&timer);
+    timer.setInterrupts(&MEM.IS);
+    serial.setInterrupts(&MEM.IS);
+    context.joypad.setInterrupts(&MEM.IS);
+    GC.setScheduler(&scheduler);
+    timer.setScheduler(&scheduler);
+    AP.setScheduler(&scheduler);
+    serial.setScheduler(&scheduler);
+}
+void GameBoy::init(){
+    GB.init();
+    context.joypad.update();
+}
+// Components only run when their next event is due. A halted CPU skips
+// straight to it, in the same 4 cycle steps it would have idled in.
+void GameBoy::step(){
+    if (GB.sleeping()){
+        uint64_t idle = scheduler.next() - scheduler.now;
+        scheduler.now += (idle + 3) & ~uint64_t(3);
+    }else scheduler.now += GB.step();
+    if (scheduler.now >= scheduler.next()) dispatch();
+}
+void GameBoy::dispatch(){
+    EventType type;
+    while (scheduler.pop(type)){
+        switch (type) {
+            case EVENT_PPU: GC.sync(); break;
+            case EVENT_TIMER: timer.sync(); break;
+            case EVENT_SEQUENCER: timer.sequencerEdge(); break;
+            case EVENT_AUDIO: AP.update(); break;
+            case EVENT_SERIAL: serial.update(); break;
+            default: break;
+        }
+    }
+}
+// Runs until the PPU hands over the next frame (blank ones included
+// while the LCD is off)
+void GameBoy::runFrame(){
+    uint32_t frame = GC.frames;
+    while (GC.frames == frame) step();
+}
+void GameBoy::start(){
+    init();
+    while (context.isOpen()){
+        if (!rewind && !runAhead){
+            step();
+            continue;
+        }
+        if (rewind && context.rewinding) rewind->stepBack();
+        if (runAhead) runAhead->frame();
+        else runFrame();
+        if (rewind && !context.rewinding) rewind->frame();
+    }
+}
+
+// Copied as they are: changing any of these layouts needs STATE_VERSION bumped
+static_assert(sizeof(InterruptState) == 3, "state layout");
+static_assert(sizeof(HDMAstate) == 14, "state layout");
+static_assert(sizeof(PPUState) == 268, "state layout");
+static_assert(sizeof(TimerState) == 24, "state layout");
+static_assert(sizeof(Channel) == 36, "state layout");
+
+void GameBoy::saveSections(StateWriter& state){
+    StateHeader header{STATE_MAGIC, STATE_VERSION, 0, MEM.cartridge()};
+    state.put(header);
+    scheduler.saveState(state);
+    GB.saveState(state);
+    MEM.saveState(state);
+    GC.saveState(state);
+    AP.saveState(state);
+    timer.saveState(state);
+    serial.saveState(state);
+    context.joypad.saveState(state);
+}
+size_t GameBoy::stateSize(){
+    StateWriter counter(nullptr, 0);
+    saveSections(counter);
+    return counter.size();
+}
+bool GameBoy::saveState(uint8_t* buffer, size_t size){
+    StateWriter state(buffer, size);
+    saveSections(state);
+    if (!state.fits()) return false;
+    uint32_t total = state.size();
+    memcpy(buffer + offsetof(StateHeader, size), &total, sizeof(total));
+    return true;
+}
+bool GameBoy::loadState(const uint8_t* buffer, size_t size){
+    StateWriter counter(nullptr, 0);
+    saveSections(counter);
+    StateReader state(buffer, size);
+    StateHeader header;
+    // Layout, banking, modes and every pending time are checked before
+    // the first section is applied, past that point none of them can fail
+    uint64_t now;
+    if (!state.header(header) || header.cartridge != MEM.cartridge() || size != counter.size()
+        || !state.matches(counter.layout()) || !scheduler.checkState(state, now)
+        || !MEM.checkState(state) || !GC.checkState(state, now) || !AP.checkState(state, now)
+        || !timer.checkState(state, now))
+        return false;
+    return scheduler.loadState(state) && GB.loadState(state) && MEM.loadState(state)
+        && GC.loadState(state) && AP.loadState(state) && timer.loadState(state)
+        && serial.loadState(state) && context.joypad.loadState(state);
+}
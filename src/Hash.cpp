@@ -0,0 +1,100 @@
+#include <cstring>
+
+#include "../include/Hash.hpp"
+#include "../include/types.hpp"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define PRIME32_1 0x9E3779B1U
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+
+#define STRIPE 64
+#define ROW_STRIPES (SCW * 4 / STRIPE)
+
+__extension__ typedef unsigned __int128 uint128_t;
+
+// Per stripe keys, the same role as the XXH3 secret
+struct Secret{
+    uint64_t key[ROW_STRIPES + 8];
+    Secret(){
+        uint64_t x = PRIME64_3;
+        for (int i = 0; i < ROW_STRIPES + 8; i++){
+            x += PRIME64_1;
+            uint64_t z = x;
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+            key[i] = z ^ (z >> 31);
+        }
+    }
+};
+static const Secret secret;
+
+#if defined(__SSE2__)
+static void accumulateRow(uint64_t* acc, const uint8_t* row){
+    __m128i a[4];
+    for (int i = 0; i < 4; i++) a[i] = _mm_loadu_si128((const __m128i*)acc + i);
+
+    for (int s = 0; s < ROW_STRIPES; s++){
+        const uint8_t* p = row + s * STRIPE;
+        const uint64_t* key = secret.key + s;
+        for (int i = 0; i < 4; i++){
+            __m128i data = _mm_loadu_si128((const __m128i*)p + i);
+            __m128i k = _mm_loadu_si128((const __m128i*)(key + i*2));
+            __m128i dk = _mm_xor_si128(data, k);
+            __m128i product = _mm_mul_epu32(dk, _mm_srli_epi64(dk, 32));
+            __m128i swapped = _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+            a[i] = _mm_add_epi64(a[i], _mm_add_epi64(product, swapped));
+        }
+    }
+    for (int i = 0; i < 4; i++) _mm_storeu_si128((__m128i*)acc + i, a[i]);
+}
+#else
+static void accumulateRow(uint64_t* acc, const uint8_t* row){
+    for (int s = 0; s < ROW_STRIPES; s++){
+        const uint8_t* p = row + s * STRIPE;
+        const uint64_t* key = secret.key + s;
+        for (int i = 0; i < 8; i++){
+            uint64_t data;
+            memcpy(&data, p + i*8, 8);
+            uint64_t dk = data ^ key[i];
+            acc[i ^ 1] += data;
+            acc[i] += (dk & 0xFFFFFFFF) * (dk >> 32);
+        }
+    }
+}
+#endif
+
+static void scramble(uint64_t* acc){
+    const uint64_t* key = secret.key + ROW_STRIPES;
+    for (int i = 0; i < 8; i++){
+        uint64_t a = acc[i];
+        a ^= a >> 47;
+        a ^= key[i];
+        acc[i] = a * PRIME32_1;
+    }
+}
+static uint64_t fold(uint64_t a, uint64_t b){
+    uint128_t product = uint128_t(a) * b;
+    return uint64_t(product) ^ uint64_t(product >> 64);
+}
+uint64_t hashFrame(const uint32_t* pixels, int pitch){
+    uint64_t acc[8] = {PRIME32_1, PRIME64_1, PRIME64_2, PRIME64_3,
+                       PRIME64_1 ^ PRIME64_2, PRIME64_2 ^ PRIME64_3,
+                       PRIME64_3 ^ PRIME64_1, PRIME32_1 ^ PRIME64_1};
+    for (int y = 0; y < SCH; y++){
+        accumulateRow(acc, reinterpret_cast<const uint8_t*>(pixels + y * pitch));
+        scramble(acc);
+    }
+    uint64_t h = uint64_t(SCW * SCH * 4) * PRIME64_1;
+    for (int i = 0; i < 4; i++){
+        h += fold(acc[i*2] ^ secret.key[i*2], acc[i*2+1] ^ secret.key[i*2+1]);
+    }
+    h ^= h >> 37;
+    h *= 0x165667919E3779F9ULL;
+    h ^= h >> 32;
+    return h;
+}
@@ -0,0 +1,108 @@
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "../include/Headless.hpp"
+
+uint32_t* Framebuffer::lockFrame(int& pitch){
+    pitch = SCW;
+    return pixels;
+}
+void Framebuffer::show(){ }
+void Framebuffer::poolEvents(){ }
+bool Framebuffer::isOpen(){ return true; }
+
+void SampleBuffer::write(const int16_t* data, int count){
+    samples.insert(samples.end(), data, data + count);
+}
+
+static void writeLE(std::ofstream& file, uint32_t value, int size){
+    for (int i = 0; i < size; i++) file.put(char(value >> (i*8)));
+}
+AudioFile::~AudioFile(){
+    close();
+}
+bool AudioFile::open(const char* filename, int sampleRate){
+    std::string name = filename;
+    wav = name.size() >= 4 && name.compare(name.size() - 4, 4, ".wav") == 0;
+    rate = sampleRate;
+    bytes = 0;
+    file.open(filename, std::ios::binary);
+    if (!file) {
+        std::cerr << "Error writing " << filename << "\n";
+        return false;
+    }
+    if (!wav) return true;
+    file.write("RIFF", 4);
+    writeLE(file, 36, 4);
+    file.write("WAVEfmt ", 8);
+    writeLE(file, 16, 4);
+    writeLE(file, 1, 2);        // PCM
+    writeLE(file, 2, 2);        // stereo
+    writeLE(file, rate, 4);
+    writeLE(file, rate * 4, 4); // bytes per second
+    writeLE(file, 4, 2);        // bytes per frame
+    writeLE(file, 16, 2);       // bits per sample
+    file.write("data", 4);
+    writeLE(file, 0, 4);
+    return true;
+}
+void AudioFile::close(){
+    if (!file.is_open()) return;
+    if (wav){
+        file.seekp(4);
+        writeLE(file, 36 + bytes, 4);
+        file.seekp(40);
+        writeLE(file, bytes, 4);
+    }
+    file.close();
+}
+void AudioFile::write(const int16_t* data, int count){
+    uint8_t out[AUDIO_BLOCK * 4];
+    for (int done = 0; done < count;){
+        int chunk = std::min(count - done, AUDIO_BLOCK * 2);
+        for (int i = 0; i < chunk; i++){
+            out[i*2] = uint16_t(data[done + i]);
+            out[i*2 + 1] = uint16_t(data[done + i]) >> 8;
+        }
+        file.write(reinterpret_cast<char*>(out), chunk * 2);
+        done += chunk;
+    }
+    bytes += count * 2;
+}
+
+bool writePPM(const char* filename, const uint32_t* pixels, int pitch){
+    std::ofstream file(filename, std::ios::binary);
+    if (!file) {
+        std::cerr << "Error writing " << filename << "\n";
+        return false;
+    }
+    file << "P6\n" << SCW << " " << SCH << "\n255\n";
+    for (int y = 0; y < SCH; y++){
+        uint8_t row[SCW*3];
+        for (int x = 0; x < SCW; x++){
+            uint32_t color = pixels[y*pitch + x];
+            row[x*3] = color >> 24;
+            row[x*3 + 1] = color >> 16;
+            row[x*3 + 2] = color >> 8;
+        }
+        file.write(reinterpret_cast<char*>(row), sizeof(row));
+    }
+    return true;
+}
+// Golden files use the hash log format: "frame hash" per line, hash in hex
+bool readHashes(const char* filename, std::vector<std::pair<uint32_t, uint64_t>>& hashes){
+    std::ifstream file(filename);
+    if (!file.is_open()) {
+        std::cerr << "Error opening " << filename << "\n";
+        return false;
+    }
+    uint32_t frame;
+    std::string hash;
+    while (file >> frame >> hash){
+        hashes.push_back({frame, std::strtoull(hash.c_str(), nullptr, 16)});
+    }
+    return true;
+}
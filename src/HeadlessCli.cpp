@@ -0,0 +1,837 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include "../include/HeadlessCli.hpp"
+#include "../include/Headless.hpp"
+#include "../include/GameBoy.hpp"
+#include "../include/Script.hpp"
+#include "../include/Scaler.hpp"
+#include "../include/AudioRing.hpp"
+#include "../include/Scheduler.hpp"
+#include "../include/Rewind.hpp"
+#include "../include/RunAhead.hpp"
+#include "../include/Stretch.hpp"
+
+// Times every filter at 2x/3x/4x on one frame, taken from the ROM after
+// a couple of seconds or a synthetic pattern without one.
+static int benchScalers(const char* rom, int threads){
+    Framebuffer screen;
+    if (rom){
+        GameBoy GB(screen);
+        if (!GB.MEM.readFromFile(rom)) return 1;
+        GB.init();
+        for (int i = 0; i < 120; i++) GB.runFrame();
+    }else{
+        for (int y = 0; y < SCH; y++){
+            for (int x = 0; x < SCW; x++){
+                bool on = ((x >> 3) ^ (y >> 3) ^ ((x + y) >> 4)) & 1;
+                screen.pixels[y*SCW + x] = on ? 0x306230FF : 0x9BBC0FFF;
+            }
+        }
+    }
+    std::vector<uint32_t> out(SCW*SCH*16);
+    const char* names[] = {"nearest", "scalex", "hq", "xbr"};
+    std::cout << "threads: " << ThreadPool(threads).size() << "\n";
+    std::cout << "filter      2x ms    3x ms    4x ms\n";
+    for (int f = FILTER_NEAREST; f <= FILTER_XBR; f++){
+        char line[64];
+        int used = snprintf(line, sizeof(line), "%-8s", names[f]);
+        for (int factor = 2; factor <= 4; factor++){
+            Upscaler scaler(ScaleFilter(f), factor, threads);
+            int pitch = SCW * factor;
+            for (int i = 0; i < 5; i++) scaler.scale(screen.pixels, SCW, out.data(), pitch);
+
+            int runs = 0;
+            auto begin = std::chrono::steady_clock::now();
+            std::chrono::duration<double> elapsed{0};
+            while (elapsed.count() < 0.25 && runs < 1000){
+                scaler.scale(screen.pixels, SCW, out.data(), pitch);
+                runs++;
+                elapsed = std::chrono::steady_clock::now() - begin;
+            }
+            used += snprintf(line + used, sizeof(line) - used, " %8.3f",
+                             elapsed.count() * 1000 / runs);
+        }
+        std::cout << line << "\n";
+    }
+    return 0;
+}
+
+// Synthesizes a few seconds of one channel at a time straight through
+// AudioRenderer and reports output samples per second.
+static int benchAudio(){
+    struct Setup{
+        const char* name;
+        std::vector<std::pair<uint16_t, uint8_t>> writes;
+    };
+    // 512 Hz square/wave, noise at its fastest, constant volume, no length
+    const std::vector<Setup> setups = {
+        {"square1", {{0xFF11, 0x80}, {0xFF12, 0xF0}, {0xFF13, 0x00}, {0xFF14, 0x87}}},
+        {"square2", {{0xFF16, 0x40}, {0xFF17, 0xF0}, {0xFF18, 0x00}, {0xFF19, 0x87}}},
+        {"wave", {{0xFF30, 0x01}, {0xFF31, 0x23}, {0xFF32, 0x45}, {0xFF33, 0x67},
+                  {0xFF34, 0x89}, {0xFF35, 0xAB}, {0xFF36, 0xCD}, {0xFF37, 0xEF},
+                  {0xFF1A, 0x80}, {0xFF1C, 0x20}, {0xFF1D, 0x00}, {0xFF1E, 0x87}}},
+        {"noise", {{0xFF21, 0xF0}, {0xFF22, 0x00}, {0xFF23, 0x80}}},
+        {"all", {{0xFF11, 0x80}, {0xFF12, 0xF0}, {0xFF14, 0x87},
+                 {0xFF16, 0x40}, {0xFF17, 0xF0}, {0xFF19, 0x86},
+                 {0xFF1A, 0x80}, {0xFF1C, 0x20}, {0xFF1E, 0x85},
+                 {0xFF21, 0xF0}, {0xFF22, 0x21}, {0xFF23, 0x80}}},
+    };
+    const int seconds = 20;
+    int16_t buffer[2048];
+    std::cout << "channel   samples/s   x realtime\n";
+    for (const Setup& setup : setups){
+        AudioRenderer renderer;
+        renderer.apply(0xFF26, 0x80);
+        renderer.apply(0xFF24, 0x77);
+        renderer.apply(0xFF25, 0xFF);
+        for (auto& write : setup.writes) renderer.apply(write.first, write.second);
+
+        auto begin = std::chrono::steady_clock::now();
+        for (int done = 0; done < SAMPLE_RATE * seconds; done += 1024){
+            renderer.run(renderer.timeFor(1024));
+            renderer.read(buffer, 1024);
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+        double rate = SAMPLE_RATE * seconds / elapsed.count();
+        char line[64];
+        snprintf(line, sizeof(line), "%-8s %11.0f %12.1f", setup.name, rate, rate / SAMPLE_RATE);
+        std::cout << line << "\n";
+    }
+
+    // the mixer's inner loops on their own: a delta every 8 cycles, like
+    // the fastest noise, then integrating the samples out
+    BlipBuffer blip;
+    blip.setRates(CPU_CLOCK, SAMPLE_RATE);
+    const uint32_t frame = blip.clocksNeeded(1024);
+    const int blocks = 4000;
+    int deltas = 0;
+    int16_t samples[1024];
+    double deltaTime = 0, readTime = 0;
+    for (int b = 0; b < blocks; b++){
+        auto start = std::chrono::steady_clock::now();
+        for (uint32_t t = 0; t < frame; t += 8, deltas++) blip.addDelta(t, (t & 8) ? 6990 : -6990);
+        auto middle = std::chrono::steady_clock::now();
+        blip.endFrame(frame);
+        blip.read(samples, 1024, 1);
+        std::chrono::duration<double> add = middle - start;
+        std::chrono::duration<double> read = std::chrono::steady_clock::now() - middle;
+        deltaTime += add.count();
+        readTime += read.count();
+    }
+    char line[96];
+    snprintf(line, sizeof(line), "blip: %.2f ns per delta, %.2f ns per sample",
+             deltaTime / deltas * 1e9, readTime / (blocks * 1024.0) * 1e9);
+    std::cout << line << "\n";
+    return 0;
+}
+
+// Simulates the SDL callback path on a virtual wall clock: a frame is
+// emulated at once every frame period, the device pulls one buffer every
+// buffer/rate seconds and plays it one buffer later. A note is triggered
+// every 30 frames and timed from the start of its frame to its first
+// audible sample.
+static int benchLatency(int rate, int buffer, int latency){
+    const double framePeriod = double(FRAME_CYCLES) / CPU_CLOCK;
+    const double callbackPeriod = double(buffer) / rate;
+    const int warmup = 120, interval = 30, notes = 20;
+    int target = latency > 0 ? rate * latency / 1000 * 2 : buffer * 2 * 2;
+
+    Scheduler scheduler;
+    APU apu;
+    AudioRing ring(target, buffer * 2, false);
+    apu.setScheduler(&scheduler);
+    apu.setOutput(rate, buffer / 2);
+    apu.setSink(&ring);
+    std::vector<int16_t> pulled(buffer * 2);
+
+    int frame = 0, callback = 0, heard = 0;
+    double triggered = -1, total = 0, worst = 0;
+    while (heard < notes){
+        double frameTime = frame * framePeriod;
+        double callbackTime = callback * callbackPeriod;
+        if (frameTime <= callbackTime){
+            int phase = frame - warmup;
+            // start-up shortfall is not counted
+            if (phase == 0) ring.underruns = 0;
+            if (phase >= 0 && phase % interval == 0){
+                apu.write(0xFF26, 0x80);
+                apu.write(0xFF24, 0x77);
+                apu.write(0xFF25, 0xFF);
+                apu.write(0xFF12, 0xF0);
+                apu.write(0xFF11, 0x80);
+                apu.write(0xFF14, 0x87);
+                triggered = frameTime;
+            }else if (phase >= 0 && phase % interval == interval / 2){
+                apu.write(0xFF26, 0x00);
+            }
+            for (int done = 0; done < FRAME_CYCLES; done += 64){
+                scheduler.now += 64;
+                EventType type;
+                while (scheduler.pop(type)) apu.update();
+            }
+            frame++;
+            continue;
+        }
+        ring.pull(pulled.data(), buffer * 2);
+        for (int i = 0; triggered >= 0 && i < buffer * 2; i++){
+            if (abs(pulled[i]) < 1024) continue;
+            double delay = callbackTime + callbackPeriod + (i / 2) / double(rate) - triggered;
+            total += delay;
+            worst = std::max(worst, delay);
+            heard++;
+            triggered = -1;
+        }
+        callback++;
+    }
+    char line[96];
+    std::cout << "rate " << rate << " Hz, buffer " << buffer
+              << " frames, target " << ring.target / 2 << " frames\n";
+    snprintf(line, sizeof(line), "latency: mean %.1f ms (%.2f frames), worst %.1f ms (%.2f frames)",
+             total / notes * 1000, total / notes / framePeriod, worst * 1000, worst / framePeriod);
+    std::cout << line << "\n";
+    std::cout << "underruns: " << ring.underruns << " (" << callback << " callbacks)\n";
+    std::cout << "overruns: " << ring.overruns << " frames dropped\n";
+    return 0;
+}
+
+// out.wav -> out.square1.wav
+static std::string stemName(const std::string& filename, const char* channel){
+    size_t dot = filename.rfind('.');
+    size_t slash = filename.find_last_of("/\\");
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+        return filename + "." + channel;
+    return filename.substr(0, dot) + "." + channel + filename.substr(dot);
+}
+// FNV-1a over the sample bytes, to compare runs
+static uint64_t hashSamples(const std::vector<int16_t>& samples){
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (int16_t sample : samples){
+        hash = (hash ^ uint8_t(sample)) * 0x100000001B3ULL;
+        hash = (hash ^ uint8_t(uint16_t(sample) >> 8)) * 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+// usage: [--frames N] [--audio] [--input script] [--hash-log file]
+//        [--golden file] [--dump file.ppm] [--colors raw|lcd|gamma]
+//        [--render-threads N] [--audio-out file [--stems] [--audio-rate hz]]
+//        [--link-listen path | --link-connect path] rom.gb
+//        --bench-scalers [--threads N] [rom.gb]
+//        --bench-audio
+//        --bench-stretch
+//        --bench-latency [--audio-rate hz] [--audio-buffer N] [--audio-latency ms]
+//        --bench-state [--frames N] rom.gb
+//        --bench-rewind [--frames N] [--input script] [--rewind-interval N] rom.gb
+//        --bench-run-ahead [--frames N] [--input script] [--run-ahead N] rom.gb
+// A machine with a screen of its own, for runs with more than one
+struct SideMachine{
+    Framebuffer screen;
+    GameBoy GB{screen};
+    std::vector<uint64_t> hashes;
+
+    // quiet, and never touches the cartridge's .sv file
+    SideMachine(){
+        GB.MEM.verbose = false;
+        GB.MEM.saveFile = false;
+    }
+    void run(uint32_t frames){
+        GB.GC.hashFrames = true;
+        for (uint32_t i = 0; i < frames; i++){
+            GB.runFrame();
+            hashes.push_back(GB.GC.frameHash);
+        }
+    }
+};
+// Both roms on their own thread at the same time, through a LocalCable
+// when linked. False if a rom does not load.
+static bool runPair(const char* roms[2], uint32_t frames, bool linked,
+                    std::vector<uint64_t> hashes[2], double& seconds){
+    SideMachine* machines[2] = {new SideMachine, new SideMachine};
+    LocalCable cable;
+    LocalLink* ends[2] = {&cable.first, &cable.second};
+    bool loaded = true;
+    for (int i = 0; i < 2; i++){
+        loaded = loaded && machines[i]->GB.MEM.readFromFile(roms[i]);
+        if (linked) machines[i]->GB.serial.setLink(ends[i]);
+    }
+    if (loaded){
+        machines[0]->GB.init();
+        machines[1]->GB.init();
+        auto begin = std::chrono::steady_clock::now();
+        std::thread worker([&]{
+            machines[1]->run(frames);
+            cable.unplug();
+        });
+        machines[0]->run(frames);
+        cable.unplug();
+        worker.join();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+        seconds = elapsed.count();
+        for (int i = 0; i < 2; i++) hashes[i] = machines[i]->hashes;
+    }
+    delete machines[0];
+    delete machines[1];
+    return loaded;
+}
+// Runs two roms side by side and checks every frame hash against the
+// same rom run alone. Linked pairs cannot run alone, they are checked
+// against a second linked run instead.
+static int checkPair(const char* first, const char* second, uint32_t frames, bool linked){
+    const char* roms[2] = {first, second};
+    std::vector<uint64_t> reference[2];
+    std::vector<uint64_t> hashes[2];
+    double seconds = 0;
+    if (linked){
+        if (!runPair(roms, frames, true, reference, seconds)) return 1;
+    }else{
+        for (int i = 0; i < 2; i++){
+            SideMachine* single = new SideMachine;
+            bool loaded = single->GB.MEM.readFromFile(roms[i]);
+            if (loaded){
+                single->GB.init();
+                single->run(frames);
+            }
+            reference[i] = single->hashes;
+            delete single;
+            if (!loaded) return 1;
+        }
+    }
+    if (!runPair(roms, frames, linked, hashes, seconds)) return 1;
+
+    std::cout << "frames: " << frames << "\n";
+    std::cout << "fps: " << frames / seconds << " per machine\n";
+    int result = 0;
+    for (int i = 0; i < 2; i++){
+        uint32_t frame = 0;
+        while (frame < frames && hashes[i][frame] == reference[i][frame]) frame++;
+        char line[32];
+        snprintf(line, sizeof(line), "%016llx", (unsigned long long)hashes[i][frames - 1]);
+        std::cout << roms[i] << ": last frame " << line;
+        if (frame < frames){
+            std::cout << ", mismatch at frame " << frame << "\n";
+            result = 2;
+        }else std::cout << ", match\n";
+    }
+    return result;
+}
+
+// Round trip of a save state taken after frames: the frames after a load
+// have to hash and sound like the ones after the save, in the same
+// machine and in a fresh one, and saving again right after a load gives
+// the same bytes. Then times save and load.
+static int benchState(const char* rom, uint32_t frames){
+    const uint32_t after = 120;
+    SideMachine* machines[2] = {new SideMachine, new SideMachine};
+    SampleBuffer sinks[2];
+    for (int i = 0; i < 2; i++){
+        GameBoy& GB = machines[i]->GB;
+        if (!GB.MEM.readFromFile(rom)){
+            delete machines[0];
+            delete machines[1];
+            return 1;
+        }
+        GB.AP.setSink(&sinks[i]);
+        GB.GC.hashFrames = true;
+        GB.init();
+    }
+    SideMachine& first = *machines[0];
+    SideMachine& second = *machines[1];
+    for (uint32_t i = 0; i < frames; i++) first.GB.runFrame();
+
+    size_t size = first.GB.stateSize();
+    std::vector<uint8_t> state(size);
+    std::vector<uint8_t> again(size);
+    first.GB.saveState(state.data(), size);
+    size_t mark = sinks[0].samples.size();
+    first.run(after);
+    std::vector<uint64_t> hashes = first.hashes;
+    std::vector<int16_t> sound(sinks[0].samples.begin() + mark, sinks[0].samples.end());
+
+    bool ok = true;
+    const char* names[2] = {"same machine", "fresh machine"};
+    for (int i = 0; i < 2; i++){
+        SideMachine& machine = *machines[i];
+        if (!machine.GB.loadState(state.data(), size)){
+            std::cout << names[i] << ": load failed\n";
+            ok = false;
+            continue;
+        }
+        machine.GB.saveState(again.data(), size);
+        bool same = again == state;
+        mark = sinks[i].samples.size();
+        machine.hashes.clear();
+        machine.run(after);
+        bool frameMatch = machine.hashes == hashes;
+        bool soundMatch = std::equal(sound.begin(), sound.end(), sinks[i].samples.begin() + mark,
+                                     sinks[i].samples.end());
+        std::cout << names[i] << ": frames " << (frameMatch ? "match" : "differ")
+                  << ", audio " << (soundMatch ? "match" : "differs")
+                  << ", state " << (same ? "identical" : "differs") << "\n";
+        ok = ok && same && frameMatch && soundMatch;
+    }
+
+    // States with a ROM bank past the cartridge or a PPU mode that does
+    // not exist are turned down and leave the machine as it was
+    int32_t past = INT32_MAX - 2*ROM_BANKSIZE;
+    int32_t mode = 4;
+    const struct { const char* name; uint32_t id; size_t offset; const int32_t* value; } damages[] = {
+        {"ROM bank", STATE_ID('M', 'E', 'M', ' '), sizeof(int32_t), &past}, // ROM1offset
+        {"PPU mode", STATE_ID('P', 'P', 'U', ' '), sizeof(uint64_t), &mode}, // after syncedTo
+    };
+    std::vector<uint8_t> before(size);
+    for (const auto& damage : damages){
+        std::vector<uint8_t> damaged = state;
+        size_t at = sizeof(StateHeader);
+        StateSection section{};
+        while (at + sizeof(section) <= size){
+            memcpy(&section, damaged.data() + at, sizeof(section));
+            at += sizeof(section);
+            if (section.id == damage.id) break;
+            at += section.size;
+        }
+        memcpy(damaged.data() + at + damage.offset, damage.value, sizeof(int32_t));
+        second.GB.saveState(before.data(), size);
+        bool rejected = !second.GB.loadState(damaged.data(), size);
+        second.GB.saveState(again.data(), size);
+        bool untouched = again == before;
+        std::cout << "damaged " << damage.name << ": " << (rejected ? "rejected" : "loaded")
+                  << ", machine " << (untouched ? "untouched" : "changed") << "\n";
+        ok = ok && rejected && untouched;
+    }
+
+    const int runs = 2000;
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < runs; i++) second.GB.saveState(again.data(), size);
+    std::chrono::duration<double> saving = std::chrono::steady_clock::now() - begin;
+    begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < runs; i++) second.GB.loadState(state.data(), size);
+    std::chrono::duration<double> loading = std::chrono::steady_clock::now() - begin;
+    std::cout << "state: " << size << " bytes\n";
+    std::cout << "save: " << saving.count() * 1e6 / runs << " us\n";
+    std::cout << "load: " << loading.count() * 1e6 / runs << " us\n";
+    delete machines[0];
+    delete machines[1];
+    return ok ? 0 : 2;
+}
+
+// Records frames into a rewind history, then steps back through all of
+// it: the frame run after each step has to hash like the one recorded
+// after that snapshot. Reports what the history costs.
+static int benchRewind(const char* rom, uint32_t frames, const char* input, int interval){
+    InputScript script;
+    if (input && !script.load(input)) return 1;
+    SideMachine* machine = new SideMachine;
+    GameBoy& GB = machine->GB;
+    Joypad& joypad = machine->screen.joypad;
+    SampleBuffer sink;
+    if (!GB.MEM.readFromFile(rom)){
+        delete machine;
+        return 1;
+    }
+    GB.AP.setSink(&sink);
+    GB.GC.hashFrames = true;
+    GB.init();
+    Rewind* rewind = new Rewind(GB, interval, SIZE_MAX);
+
+    // joypad state the script had at every frame, and the frame after
+    // every snapshot
+    std::vector<std::pair<uint8_t, uint8_t>> inputs;
+    std::vector<uint32_t> taken;
+    auto begin = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < frames; i++){
+        script.apply(i, joypad);
+        inputs.push_back({joypad.directions, joypad.buttons});
+        GB.runFrame();
+        machine->hashes.push_back(GB.GC.frameHash);
+        rewind->frame();
+        if (rewind->stats.captures > taken.size()) taken.push_back(i + 1);
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+    size_t snapshots = rewind->size();
+    size_t bytes = rewind->bytes();
+    RewindStats stats = rewind->stats;
+
+    size_t steps = 0;
+    bool mismatch = false;
+    uint32_t mismatchAt = 0;
+    double stepping = 0;
+    while (steps < taken.size()){
+        auto start = std::chrono::steady_clock::now();
+        if (!rewind->stepBack()) break;
+        std::chrono::duration<double> step = std::chrono::steady_clock::now() - start;
+        stepping += step.count();
+        uint32_t next = taken[taken.size() - 1 - steps];
+        steps++;
+        if (next >= frames) continue;
+        joypad.directions = inputs[next].first;
+        joypad.buttons = inputs[next].second;
+        joypad.update();
+        GB.runFrame();
+        if (GB.GC.frameHash != machine->hashes[next] && !mismatch){
+            mismatch = true;
+            mismatchAt = next;
+        }
+    }
+
+    double seconds = frames / 59.7275;
+    double perSnapshot = stats.captures > 1 ? double(bytes - GB.stateSize()) / (stats.captures - 1) : 0;
+    std::cout << "frames: " << frames << " (" << seconds << " s), " << (elapsed.count() > 0 ? frames / elapsed.count() : 0) << " fps\n";
+    std::cout << "snapshots: " << snapshots << ", one every " << interval << " frames\n";
+    std::cout << "memory: " << bytes / 1048576.0 << " MB, "
+              << perSnapshot << " bytes per delta, ratio "
+              << (stats.storedBytes ? double(stats.rawBytes) / stats.storedBytes : 0) << "\n";
+    std::cout << "10 minutes: " << perSnapshot * 600 * 59.7275 / interval / 1048576.0 << " MB\n";
+    std::cout << "capture: " << stats.captureSeconds * 1e6 / (stats.captures ? stats.captures : 1) << " us\n";
+    std::cout << "compress: " << stats.compressSeconds * 1e6 / (stats.captures ? stats.captures : 1) << " us (worker)\n";
+    std::cout << "step back: " << stepping * 1e6 / (steps ? steps : 1) << " us\n";
+    std::cout << "steps: " << steps;
+    if (mismatch) std::cout << ", mismatch after frame " << mismatchAt << "\n";
+    else std::cout << ", all match\n";
+    delete rewind;
+    delete machine;
+    return mismatch || steps != snapshots ? 2 : 0;
+}
+
+// One run of benchRunAhead: shown frames, sound, the state at the end
+struct AheadRun{
+    std::vector<uint64_t> hashes;
+    std::vector<std::pair<uint8_t, uint8_t>> inputs;
+    std::vector<uint8_t> state;
+    uint64_t sound{0};
+    double seconds{0};
+    RunAheadStats stats;
+};
+static bool runAheadOnce(const char* rom, uint32_t frames, const char* input, int count,
+                         bool second, AheadRun& run){
+    InputScript script;
+    if (input && !script.load(input)) return false;
+    SideMachine* machine = new SideMachine;
+    GameBoy& GB = machine->GB;
+    SampleBuffer sink;
+    if (!GB.MEM.readFromFile(rom)){
+        delete machine;
+        return false;
+    }
+    GB.AP.setSink(&sink);
+    GB.GC.hashFrames = true;
+    RunAhead* ahead = new RunAhead(GB, count, second);
+    GB.init();
+    Joypad& joypad = machine->screen.joypad;
+    auto begin = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < frames; i++){
+        script.apply(i, joypad);
+        run.inputs.push_back({joypad.directions, joypad.buttons});
+        ahead->frame();
+        run.hashes.push_back(ahead->shown().GC.frameHash);
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+    run.seconds = elapsed.count();
+    run.stats = ahead->stats;
+    run.state.resize(GB.stateSize());
+    GB.saveState(run.state.data(), run.state.size());
+    run.sound = hashSamples(sink.samples);
+    delete ahead;
+    delete machine;
+    return true;
+}
+// Plays the rom plain and then with every run-ahead count up to most, on
+// one machine and with a second. A shown frame has to match the plain
+// frame count frames later wherever input held still in between, and the
+// real machine has to end in the same state with the same sound.
+static int benchRunAhead(const char* rom, uint32_t frames, const char* input, int most){
+    AheadRun plain;
+    if (!runAheadOnce(rom, frames, input, 0, false, plain)) return 1;
+    double base = plain.seconds * 1e6 / frames;
+    std::cout << "plain: " << base << " us per frame\n";
+    bool ok = true;
+    for (int count = 1; count <= most; count++){
+        for (int second = 0; second < 2; second++){
+            AheadRun run;
+            if (!runAheadOnce(rom, frames, input, count, second, run)) return 1;
+            uint32_t checked = 0;
+            uint32_t matched = 0;
+            for (uint32_t i = 0; i + count < frames; i++){
+                bool held = true;
+                for (int j = 1; j <= count; j++) held = held && plain.inputs[i + j] == plain.inputs[i];
+                if (!held) continue;
+                checked++;
+                if (run.hashes[i] == plain.hashes[i + count]) matched++;
+            }
+            bool same = run.state == plain.state && run.sound == plain.sound;
+            double perFrame = run.seconds * 1e6 / frames;
+            double overhead = run.stats.saveSeconds + run.stats.aheadSeconds + run.stats.loadSeconds;
+            std::cout << "run-ahead " << count << (second ? ", second machine: " : ", one machine: ")
+                      << perFrame << " us per frame, " << overhead * 1e6 / frames
+                      << " us of it run-ahead (save " << run.stats.saveSeconds * 1e6 / frames
+                      << ", frames " << run.stats.aheadSeconds * 1e6 / frames
+                      << ", load " << run.stats.loadSeconds * 1e6 / frames << "), frames "
+                      << matched << "/" << checked << " match, state and audio "
+                      << (same ? "match" : "differ") << "\n";
+            ok = ok && same && matched == checked;
+        }
+    }
+    return ok ? 0 : 2;
+}
+
+// Stretches a few seconds of a 440 Hz tone to every speed in range: the
+// output has to last 1/speed as long and keep its pitch
+static int benchStretch(){
+    const int seconds = 4;
+    const int frames = SAMPLE_RATE * seconds;
+    std::vector<int16_t> tone(frames * 2);
+    for (int i = 0; i < frames; i++){
+        int16_t value = int16_t(8000 * std::sin(2 * M_PI * 440 * i / SAMPLE_RATE));
+        tone[i*2] = tone[i*2 + 1] = value;
+    }
+    const double speeds[] = {STRETCH_MIN, 0.5, 1.5, 2.0, STRETCH_MAX};
+    bool ok = true;
+    for (double speed : speeds){
+        TimeStretch stretch;
+        stretch.setSpeed(speed);
+        std::vector<int16_t> out;
+        auto begin = std::chrono::steady_clock::now();
+        for (int i = 0; i < frames; i += AUDIO_BLOCK)
+            stretch.process(tone.data() + i*2, std::min(AUDIO_BLOCK, frames - i) * 2, out);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+        int length = out.size() / 2;
+        // pitch from rising zero crossings, away from the fade in
+        int crossings = 0;
+        for (int i = STRETCH_GRAIN + 1; i < length; i++)
+            crossings += out[(i - 1)*2] < 0 && out[i*2] >= 0;
+        double pitch = crossings * double(SAMPLE_RATE) / (length - STRETCH_GRAIN - 1);
+        double expected = frames / speed;
+        // the last grains stay held back for the search
+        double held = (STRETCH_GRAIN + 2 * STRETCH_SEARCH) / speed;
+        bool good = length <= expected && length >= expected - held - STRETCH_GRAIN
+                    && std::abs(pitch - 440) < 440 * 0.02;
+        std::cout << "speed " << speed << ": " << length << " frames out of " << frames
+                  << " (" << expected << " expected), " << pitch << " Hz, "
+                  << frames / elapsed.count() / 1e6 << " M frames/s" << (good ? "" : ", wrong") << "\n";
+        ok = ok && good;
+    }
+    return ok ? 0 : 2;
+}
+
+int runHeadless(int args, char* argv[]){
+    const char* rom = nullptr;
+    const char* input = nullptr;
+    const char* hashLog = nullptr;
+    const char* golden = nullptr;
+    const char* dump = "mismatch.ppm";
+    const char* audioOut = nullptr;
+    bool stems = false;
+    const char* linkListen = nullptr;
+    const char* linkConnect = nullptr;
+    const char* pair = nullptr;
+    const char* loadState = nullptr;
+    const char* saveState = nullptr;
+    bool linkLocal = false;
+    uint32_t frames = 3600;
+    bool audio = false;
+    bool bench = false;
+    bool benchLatencies = false;
+    bool benchStates = false;
+    bool benchRewinds = false;
+    int rewindInterval = 2;
+    bool benchRunAheads = false;
+    int runAheadFrames = 3;
+    int audioRate = SAMPLE_RATE;
+    int audioBuffer = 2048;
+    int audioLatency = 0;
+    int threads = 0;
+    int renderThreads = -1;
+    ColorMode colors = COLOR_RAW;
+    for (int i = 1; i < args; i++){
+        std::string arg = argv[i];
+        if (arg == "--frames" && i + 1 < args){
+            frames = std::strtoul(argv[++i], nullptr, 10);
+        }else if (arg == "--audio"){
+            audio = true;
+        }else if (arg == "--audio-out" && i + 1 < args){
+            audioOut = argv[++i];
+        }else if (arg == "--stems"){
+            stems = true;
+        }else if (arg == "--link-listen" && i + 1 < args){
+            linkListen = argv[++i];
+        }else if (arg == "--link-connect" && i + 1 < args){
+            linkConnect = argv[++i];
+        }else if (arg == "--load-state" && i + 1 < args){
+            loadState = argv[++i];
+        }else if (arg == "--save-state" && i + 1 < args){
+            saveState = argv[++i];
+        }else if (arg == "--pair" && i + 1 < args){
+            pair = argv[++i];
+        }else if (arg == "--link-local"){
+            linkLocal = true;
+        }else if (arg == "--input" && i + 1 < args){
+            input = argv[++i];
+        }else if (arg == "--hash-log" && i + 1 < args){
+            hashLog = argv[++i];
+        }else if (arg == "--golden" && i + 1 < args){
+            golden = argv[++i];
+        }else if (arg == "--dump" && i + 1 < args){
+            dump = argv[++i];
+        }else if (arg == "--colors" && i + 1 < args){
+            if (!parseColorMode(argv[++i], colors)){
+                std::cerr << "unknown color mode " << argv[i] << "\n";
+                return 1;
+            }
+        }else if (arg == "--render-threads" && i + 1 < args){
+            renderThreads = atoi(argv[++i]);
+        }else if (arg == "--bench-audio"){
+            return benchAudio();
+        }else if (arg == "--bench-stretch"){
+            return benchStretch();
+        }else if (arg == "--bench-state"){
+            benchStates = true;
+        }else if (arg == "--bench-rewind"){
+            benchRewinds = true;
+        }else if (arg == "--rewind-interval" && i + 1 < args){
+            rewindInterval = atoi(argv[++i]);
+        }else if (arg == "--bench-run-ahead"){
+            benchRunAheads = true;
+        }else if (arg == "--run-ahead" && i + 1 < args){
+            runAheadFrames = atoi(argv[++i]);
+        }else if (arg == "--bench-latency"){
+            benchLatencies = true;
+        }else if (arg == "--audio-rate" && i + 1 < args){
+            audioRate = atoi(argv[++i]);
+        }else if (arg == "--audio-buffer" && i + 1 < args){
+            audioBuffer = atoi(argv[++i]);
+        }else if (arg == "--audio-latency" && i + 1 < args){
+            audioLatency = atoi(argv[++i]);
+        }else if (arg == "--bench-scalers"){
+            bench = true;
+        }else if (arg == "--threads" && i + 1 < args){
+            threads = atoi(argv[++i]);
+        }else rom = argv[i];
+    }
+    if (bench) return benchScalers(rom, threads);
+    if (benchLatencies) return benchLatency(audioRate, audioBuffer, audioLatency);
+    if (!rom){
+        std::cerr << "usage: " << argv[0] << " [--frames N] [--audio] [--input script]"
+                     " [--hash-log file] [--golden file] [--dump file.ppm]"
+                     " [--colors raw|lcd|gamma] [--render-threads N]"
+                     " [--audio-out file [--stems] [--audio-rate hz]]"
+                     " [--link-listen path | --link-connect path]"
+                     " [--load-state file] [--save-state file] rom.gb\n"
+                  << "       " << argv[0] << " [--frames N] --pair other.gb [--link-local] rom.gb\n"
+                  << "       " << argv[0] << " --bench-scalers [--threads N] [rom.gb]\n"
+                  << "       " << argv[0] << " --bench-audio\n"
+                  << "       " << argv[0] << " --bench-stretch\n"
+                  << "       " << argv[0] << " --bench-state [--frames N] rom.gb\n"
+                  << "       " << argv[0] << " --bench-rewind [--frames N] [--input script]"
+                     " [--rewind-interval N] rom.gb\n"
+                  << "       " << argv[0] << " --bench-run-ahead [--frames N] [--input script]"
+                     " [--run-ahead N] rom.gb\n"
+                  << "       " << argv[0] << " --bench-latency [--audio-rate hz]"
+                     " [--audio-buffer N] [--audio-latency ms]\n";
+        return 1;
+    }
+    if (benchStates) return benchState(rom, frames);
+    if (benchRunAheads) return benchRunAhead(rom, frames, input, runAheadFrames);
+    if (benchRewinds) return benchRewind(rom, frames, input, rewindInterval < 1 ? 1 : rewindInterval);
+    if (pair) return checkPair(rom, pair, frames ? frames : 1, linkLocal);
+
+    InputScript script;
+    if (input && !script.load(input)) return 1;
+    std::vector<std::pair<uint32_t, uint64_t>> expected;
+    if (golden && !readHashes(golden, expected)) return 1;
+    std::ofstream log;
+    if (hashLog){
+        log.open(hashLog);
+        if (!log) {
+            std::cerr << "Error writing " << hashLog << "\n";
+            return 1;
+        }
+    }
+
+    Framebuffer screen;
+    GameBoy GB(screen);
+    SampleBuffer sink;
+    AudioFile file;
+    AudioFile stemFiles[4];
+    const char* stemNames[4] = {"square1", "square2", "wave", "noise"};
+    if (audioOut){
+        if (!file.open(audioOut, audioRate)) return 1;
+        GB.AP.setSink(&file);
+        for (int c = 0; stems && c < 4; c++){
+            if (!stemFiles[c].open(stemName(audioOut, stemNames[c]).c_str(), audioRate)) return 1;
+            GB.AP.setStem(c, &stemFiles[c]);
+        }
+    }else if (audio) GB.AP.setSink(&sink);
+    GB.AP.setOutput(audioRate, AUDIO_BLOCK);
+    GB.GC.hashFrames = hashLog || golden;
+    GB.GC.setColorMode(colors);
+    GB.GC.setParallel(renderThreads);
+    if (!GB.MEM.readFromFile(rom)) return 1;
+    SocketLink link;
+    if (linkListen && !link.listen(linkListen)) return 1;
+    if (linkConnect && !link.connect(linkConnect)) return 1;
+    if (linkListen || linkConnect) GB.serial.setLink(&link);
+
+    auto begin = std::chrono::steady_clock::now();
+    GB.init();
+    if (loadState){
+        std::ifstream file(loadState, std::ios::binary);
+        std::vector<uint8_t> state((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        if (!GB.loadState(state.data(), state.size())){
+            std::cerr << "Error loading state " << loadState << "\n";
+            return 1;
+        }
+    }
+    size_t check = 0;
+    for (uint32_t i = 0; i < frames; i++){
+        script.apply(i, screen.joypad);
+        GB.runFrame();
+
+        uint64_t hash = GB.GC.frameHash;
+        if (hashLog){
+            char line[32];
+            snprintf(line, sizeof(line), "%u %016llx\n", i, (unsigned long long)hash);
+            log << line;
+        }
+        while (check < expected.size() && expected[check].first < i) check++;
+        if (check < expected.size() && expected[check].first == i){
+            if (expected[check].second != hash){
+                std::cout << "mismatch at frame " << i << ", dumped to " << dump << "\n";
+                writePPM(dump, screen.pixels, SCW);
+                return 2;
+            }
+            check++;
+        }
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+    if (saveState){
+        std::vector<uint8_t> state(GB.stateSize());
+        GB.saveState(state.data(), state.size());
+        std::ofstream file(saveState, std::ios::binary);
+        if (!file.write(reinterpret_cast<char*>(state.data()), state.size())){
+            std::cerr << "Error writing " << saveState << "\n";
+            return 1;
+        }
+    }
+
+    std::cout << "frames: " << frames << "\n";
+    std::cout << "time: " << elapsed.count() << " s\n";
+    std::cout << "fps: " << frames / elapsed.count() << "\n";
+    if (audio && !audioOut){
+        char line[64];
+        snprintf(line, sizeof(line), "%016llx", (unsigned long long)hashSamples(sink.samples));
+        std::cout << "samples: " << sink.samples.size() / 2 << "\n";
+        std::cout << "audio hash: " << line << "\n";
+    }
+    if (golden) std::cout << "golden: match\n";
+    return 0;
+}
@@ -1,5 +1,8 @@
 #include "../include/Joypad.hpp"
 
+void Joypad::setInterrupts(InterruptState* master){
+    IS = master;
+}
 void Joypad::update(){
     uint8_t result = Joypad & 0xF0;
     if (!(Joypad & 0x20)) {
@@ -10,7 +13,7 @@ void Joypad::update(){
     }
     
     Joypad = result;
-    IS.IF |= INPUT;
+    if (IS) IS->IF |= INPUT;
 }
 
 bool Joypad::write(uint16_t addr, uint8_t data){
@@ -27,4 +30,12 @@ bool Joypad::read(uint16_t addr, uint8_t& data){
         return true;
     }
     return false;
-}
\ No newline at end of file
+}
+void Joypad::saveState(StateWriter& state){
+    state.begin(STATE_ID('J', 'O', 'Y', 'P'));
+    state.put(Joypad);
+    state.end();
+}
+bool Joypad::loadState(StateReader& state){
+    return state.begin(STATE_ID('J', 'O', 'Y', 'P')) && state.get(Joypad);
+}
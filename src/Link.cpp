@@ -0,0 +1,139 @@
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "../include/Link.hpp"
+
+LocalLink::LocalLink(RingBuffer<LinkMessage>& in,
+                     RingBuffer<LinkMessage>& out, std::atomic<bool>& open) :
+in(in), out(out), open(open)
+{ }
+void LocalLink::send(const LinkMessage& message){
+    while (!out.push(message) && open) std::this_thread::yield();
+}
+bool LocalLink::receive(LinkMessage& message, bool wait){
+    for (;;){
+        if (in.peek(message)){
+            in.pop();
+            return true;
+        }
+        if (!wait || !open) return false;
+        std::this_thread::yield();
+    }
+}
+bool LocalLink::connected(){
+    return open;
+}
+LocalCable::LocalCable() : forward(LINK_QUEUE), backward(LINK_QUEUE),
+first(backward, forward, open), second(forward, backward, open)
+{ }
+void LocalCable::unplug(){
+    open = false;
+}
+
+// Messages go over the socket as 8 bytes of little-endian time, type, data
+static void encode(const LinkMessage& message, uint8_t* out){
+    for (int i = 0; i < 8; i++) out[i] = message.time >> (i*8);
+    out[8] = message.type;
+    out[9] = message.data;
+}
+static LinkMessage decode(const uint8_t* in){
+    LinkMessage message{0, in[8], in[9]};
+    for (int i = 0; i < 8; i++) message.time |= uint64_t(in[i]) << (i*8);
+    return message;
+}
+static bool socketAddress(const char* path, sockaddr_un& address){
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)){
+        std::cerr << "link socket path too long\n";
+        return false;
+    }
+    strcpy(address.sun_path, path);
+    return true;
+}
+
+SocketLink::~SocketLink(){
+    if (fd >= 0) close(fd);
+    if (listener >= 0){
+        close(listener);
+        unlink(path.c_str());
+    }
+}
+// Waits for the other side to connect
+bool SocketLink::listen(const char* name){
+    sockaddr_un address;
+    if (!socketAddress(name, address)) return false;
+    path = name;
+    unlink(name);
+    listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0 || bind(listener, (sockaddr*)&address, sizeof(address)) < 0 ||
+        ::listen(listener, 1) < 0){
+        std::cerr << "Error listening on " << name << "\n";
+        return false;
+    }
+    std::cout << "link: waiting on " << name << "\n";
+    fd = accept(listener, nullptr, nullptr);
+    if (fd < 0){
+        std::cerr << "Error accepting link\n";
+        return false;
+    }
+    return true;
+}
+// Retries for a few seconds while the listening side comes up
+bool SocketLink::connect(const char* name){
+    sockaddr_un address;
+    if (!socketAddress(name, address)) return false;
+    for (int attempt = 0; attempt < 50; attempt++){
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd >= 0 && ::connect(fd, (sockaddr*)&address, sizeof(address)) == 0) return true;
+        if (fd >= 0) close(fd);
+        fd = -1;
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    std::cerr << "Error connecting to " << name << "\n";
+    return false;
+}
+void SocketLink::send(const LinkMessage& message){
+    if (fd < 0) return;
+    uint8_t bytes[10];
+    encode(message, bytes);
+    for (int done = 0; done < 10;){
+        ssize_t sent = ::send(fd, bytes + done, 10 - done, MSG_NOSIGNAL);
+        if (sent <= 0){
+            close(fd);
+            fd = -1;
+            return;
+        }
+        done += sent;
+    }
+}
+bool SocketLink::receive(LinkMessage& message, bool wait){
+    while (fd >= 0){
+        ssize_t got = recv(fd, partial + have, 10 - have, wait ? 0 : MSG_DONTWAIT);
+        if (got == 0 || (got < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)){
+            close(fd);
+            fd = -1;
+            return false;
+        }
+        if (got < 0) {
+            if (!wait) return false;
+            continue;
+        }
+        have += got;
+        if (have == 10){
+            have = 0;
+            message = decode(partial);
+            return true;
+        }
+    }
+    return false;
+}
+bool SocketLink::connected(){
+    return fd >= 0;
+}
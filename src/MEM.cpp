@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cstdint>
 #include <fstream>
 #include <iostream>
@@ -6,7 +7,7 @@
 #include "../include/APU.hpp"
 #include "../include/PPU.hpp"
 #include "../include/Timer.hpp"
-#include "../include/Display.hpp"
+#include "../include/Serial.hpp"
 
 void extractFilename(std::string& path) {
     size_t dot_pos = path.find_last_of('.');
@@ -16,15 +17,15 @@ void extractFilename(std::string& path) {
 }
 
 MemoryMaster::MemoryMaster(){
-    OAM = new uint8_t[0xA0];
-    IO = new uint8_t[0x100];
+    OAM = new uint8_t[0xA0]();
+    IO = new uint8_t[0x100]();
 }
 MemoryMaster::~MemoryMaster(){
-    if (CRAMsize != 0){
-        std::cout <<"saved\n";
+    if (CRAMsize != 0 && saveFile){
+        if (verbose) std::cout <<"saved\n";
         writeSaveToFile();
     }
-    if (ROM) delete[] ROM;
+    delete ownImage;
     if (CRAM) delete[] CRAM;
     if (VRAM) delete[] VRAM;
     if (RAM) delete[] RAM;
@@ -114,12 +115,23 @@ void MemoryMaster::HDMAstep(){
         hdma.work = false;
     }
 }
+bool MemoryMaster::HDMAactive(){
+    return hdma.work;
+}
+// Registers that either show how far the lazy PPU has run or change
+// what it will do next, the PPU has to catch up before they are touched.
+static bool touchesPPU(uint16_t addr){
+    return (addr >= 0xFF40 && addr <= 0xFF4B) ||
+           (addr >= 0xFF68 && addr <= 0xFF6C) ||
+           addr == 0xFF0F || addr == 0xFF55 || addr == 0xFFFF;
+}
 uint8_t MemoryMaster::read(uint16_t addr){
     if (addr < 0x4000){
         return ROM[ROM0offset + addr];
     }else if (addr < 0x8000){
         return ROM[ROM1offset + addr];
     }else if (addr < 0xA000){
+        ppu->sync();
         return readVRAM(addr);
     }else if (addr < 0xC000){
         if (CRAMenable){
@@ -132,6 +144,7 @@ uint8_t MemoryMaster::read(uint16_t addr){
         if (addr < 0xFE00){
             return readWRAM(addr-0x2000);
         }if (addr < 0xFEA0){
+            ppu->sync();
             return readOAM(addr);
         }if (addr >= 0xFF00){
             return readIO(addr);
@@ -159,10 +172,18 @@ uint8_t MemoryMaster::readVRAM(uint16_t addr){
 uint8_t MemoryMaster::readOAM(uint16_t addr){
     return OAM[addr-0xFE00];
 }
+const uint8_t* MemoryMaster::VRAMdata(){
+    return VRAM;
+}
+const uint8_t* MemoryMaster::OAMdata(){
+    return OAM;
+}
 uint8_t MemoryMaster::readIO(uint16_t addr){
     uint8_t data = 0xFF;
+    if (touchesPPU(addr)) ppu->sync();
     if (ppu->read(addr, data)) return data;
     if (timer->read(addr, data)) return data;
+    if (serial->read(addr, data)) return data;
     if (joypad->read(addr, data)) return data;
     if (apu->read(addr, data)) return data;
     switch (addr) {
@@ -215,6 +236,7 @@ void MemoryMaster::write(uint16_t addr, uint8_t data){
             }break;
         }
     }else if (addr < 0xA000){
+        ppu->sync();
         writeVRAM(addr, data);
     }else if (addr < 0xC000){
         if (CRAMenable){
@@ -226,6 +248,7 @@ void MemoryMaster::write(uint16_t addr, uint8_t data){
         if (addr < 0xFE00){
             writeWRAM(addr - 0x2000, data);
         }else if (addr < 0xFEA0){
+            ppu->sync();
             writeOAM(addr, data);
         }else if (addr >= 0xFF00){
             writeIO(addr, data);
@@ -233,6 +256,7 @@ void MemoryMaster::write(uint16_t addr, uint8_t data){
     }
 }
 void MemoryMaster::writeVRAM(uint16_t addr, uint8_t data){
+    ppu->videoWrite();
     VRAM[VRAMoffset + addr - 0x8000] = data;
 }
 void MemoryMaster::writeWRAM(uint16_t addr, uint8_t data){
@@ -244,11 +268,14 @@ void MemoryMaster::writeWRAM(uint16_t addr, uint8_t data){
     }
 }
 void MemoryMaster::writeOAM(uint16_t addr, uint8_t data){
+    ppu->videoWrite();
     OAM[addr-0xFE00] = data;
 }
 void MemoryMaster::writeIO(uint16_t addr, uint8_t data){
+    if (touchesPPU(addr)) ppu->sync();
     if (ppu->write(addr, data)) return;
     if (timer->write(addr, data)) return;
+    if (serial->write(addr, data)) return;
     if (joypad->write(addr, data)) return;
     if (apu->write(addr, data)) return;
     switch (addr) {
@@ -257,9 +284,12 @@ void MemoryMaster::writeIO(uint16_t addr, uint8_t data){
             break;
         case(0xFF41): // STAT
             IS.STAT = (IS.STAT & 0x87) | (data & 0x78);
+            ppu->updateDeadline();
             break;
         case (0xFF46):{
+            ppu->sync();
             uint16_t value = data << 8;
+            ppu->videoWrite();
             for (int x = 0; x < 160; x++){
                 OAM[x] = read(value+x);
             } break;
@@ -289,6 +319,7 @@ void MemoryMaster::writeIO(uint16_t addr, uint8_t data){
                     // Cancel ongoing H-Blank HDMA transfer
                     hdma.work = false;
                     hdma.hdma5 = 0xff;
+                    ppu->updateDeadline();
                     return;
                 }
                 uint16_t blocks = (data & 0x7F) + 1;
@@ -308,6 +339,7 @@ void MemoryMaster::writeIO(uint16_t addr, uint8_t data){
                     hdma.hdma5 = blocks - 1;
                     if ((IS.STAT & 3) == 0) // H-Blank
                         HDMAstep();
+                    ppu->updateDeadline();
                 }
             } break;
         case (0xFF70):
@@ -318,6 +350,7 @@ void MemoryMaster::writeIO(uint16_t addr, uint8_t data){
             } break;
         case(0xFFFF): // LCDC
             IS.IE = data;
+            ppu->updateDeadline();
             break;
         default:
             if (addr >= 0xFF00) IO[addr-0xFF00] = data;
@@ -342,64 +375,88 @@ void MemoryMaster::writeSaveToFile(){
     file.write(reinterpret_cast<char*>(CRAM), sizeof(char) * CRAMsize);
     file.close();
 }
-bool MemoryMaster::readFromFile(const char* filename){
-    std::ifstream file(filename, std::ios::binary);
-    readedFilename = filename;
-    extractFilename(readedFilename);
-    std::cout<<"read: "<<filename<<"\n";
+static bool romSize(uint8_t code, uint32_t& size){
+    if (code > 0x08) return false;
+    size = (32 * 1024) << code;
+    return true;
+}
+RomImage::~RomImage(){
+    delete[] data;
+}
+bool RomImage::readFromFile(const char* name){
+    std::ifstream file(name, std::ios::binary);
+    filename = name;
     if (!file.is_open()) {
         std::cerr << "Error opening file\n";
         return false;
     }
     char byte;
-
-    file.seekg(0x143, std::ios::beg);
+    file.seekg(0x0148, std::ios::beg);
     file.get(byte);
-    uint8_t GBtype = byte;
+    if (!romSize(byte, size)){
+        std::cerr<<"unrecognizer ROM\n";
+        return false;
+    }
+    data = new uint8_t[size];
+    file.seekg(0, std::ios::beg);
+    if (!file.read(reinterpret_cast<char*>(data), size)) {
+        std::cerr << "Error reading " << name << "\n";
+        return false;
+    }
+    return true;
+}
+bool RomImage::readFromMemory(const uint8_t* image, size_t length){
+    if (length < 0x150 || !romSize(image[0x148], size)){
+        std::cerr<<"unrecognizer ROM\n";
+        return false;
+    }
+    if (length < size){
+        std::cerr << "ROM image shorter than its header says\n";
+        return false;
+    }
+    data = new uint8_t[size];
+    std::copy(image, image + size, data);
+    return true;
+}
+bool MemoryMaster::readFromFile(const char* filename){
+    if (verbose) std::cout<<"read: "<<filename<<"\n";
+    ownImage = new RomImage;
+    return ownImage->readFromFile(filename) && load(*ownImage);
+}
+const RomImage* MemoryMaster::image(){
+    return loadedImage;
+}
+bool MemoryMaster::load(const RomImage& image){
+    readedFilename = image.filename;
+    extractFilename(readedFilename);
+    const uint8_t* header = image.data;
+
+    uint8_t GBtype = header[0x143];
     if (GBtype == 0xC0 || GBtype == 0x80){
         isCGB = true;
-        std::cout<<"CGB mode\n";
-        VRAM = new uint8_t[0x4000]; // 2 banks
-        RAM = new uint8_t[0x10000]; // 8 banks
-        for (int x = 0; x < 0x4000; x++) VRAM[x] = 0;
+        if (verbose) std::cout<<"CGB mode\n";
+        VRAM = new uint8_t[0x4000](); // 2 banks
+        RAM = new uint8_t[0x10000](); // 8 banks
     }else{
-        std::cout<<"DMG mode\n";
-        VRAM = new uint8_t[0x2000];
-        RAM = new uint8_t[0x2000];
-        for (int x = 0; x < 0x2000; x++) VRAM[x] = 0;
+        if (verbose) std::cout<<"DMG mode\n";
+        VRAM = new uint8_t[0x2000]();
+        RAM = new uint8_t[0x2000]();
     }
 
-    file.seekg(0x0147, std::ios::beg);
-    file.get(byte);
+    uint8_t byte = header[0x147];
     if (byte <= 0x03) MBCtype = MBC1;
     else if (byte <= 0x0D) MBCtype = MBC2;
     else if (byte <= 0x13) MBCtype = MBC3;
     else MBCtype = MBC5;
-    std::cout<<"MCB: "<<MBCtype<<"\n";
+    if (verbose) std::cout<<"MCB: "<<MBCtype<<"\n";
 
-    file.seekg(0x0148, std::ios::beg);
-    file.get(byte);
-    switch (byte) {
-        case(0x00): ROMsize = 32 * 1024; break;
-        case(0x01): ROMsize = 64 * 1024; break;
-        case(0x02): ROMsize = 128 * 1024; break;
-        case(0x03): ROMsize = 256 * 1024; break;
-        case(0x04): ROMsize = 512 * 1024; break;
-        case(0x05): ROMsize = 1024 * 1024; break;
-        case(0x06): ROMsize = 2048 * 1024; break;
-        case(0x07): ROMsize = 4096 * 1024; break;
-        case(0x08): ROMsize = 8192 * 1024; break;
-        default:
-            std::cout<<"unrecognizer ROM\n";
-            return false;
-    }
+    ROMsize = image.size;
     totalROMbanks = ROMsize / (16*1024);
-    ROM = new uint8_t[ROMsize];
-    std::cout<<"ROM banks: "<<int(totalROMbanks)<<"\n";
+    ROM = image.data;
+    loadedImage = &image;
+    if (verbose) std::cout<<"ROM banks: "<<int(totalROMbanks)<<"\n";
 
-    file.seekg(0x0149, std::ios::beg);
-    file.get(byte);
-    switch (byte) {
+    switch (header[0x149]) {
         case(0x00): CRAMsize = 2 * 1024; break; // 0
         case(0x01): CRAMsize = 2 * 1024; break;
         case(0x02): CRAMsize = 8 * 1024; break;
@@ -414,18 +471,11 @@ bool MemoryMaster::readFromFile(const char* filename){
             return false;
     }
     if (CRAMsize != 0){
-        CRAM = new uint8_t[CRAMsize];
-        readSaveFromFile();
+        CRAM = new uint8_t[CRAMsize]();
+        if (saveFile) readSaveFromFile();
     }
     totalRAMbanks = CRAMsize / (8 * 1024);
-    std::cout<<"RAM banks: "<<int(totalRAMbanks)<<"\n";
-
-    file.seekg(0, std::ios::beg);
-    if (!file.read(reinterpret_cast<char*>(ROM), ROMsize)) {
-        return false;
-    }
-    file.close();
-
+    if (verbose) std::cout<<"RAM banks: "<<int(totalRAMbanks)<<"\n";
 
     return true;
 }
@@ -440,4 +490,75 @@ void MemoryMaster::setPPU(PPU* master){
 }
 void MemoryMaster::setAPU(APU* master){
     apu = master;
-}
\ No newline at end of file
+}
+void MemoryMaster::setSerial(Serial* master){
+    serial = master;
+}
+uint32_t MemoryMaster::cartridge(){
+    return ROM ? ROM[0x14D] | ROM[0x14E] << 8 | ROM[0x14F] << 16 | ROM[0x143] << 24 : 0;
+}
+struct MEMSection{
+    int32_t ROM0offset;
+    int32_t ROM1offset;
+    uint32_t RAMoffset;
+    uint32_t WRAMoffset;
+    uint32_t VRAMoffset;
+    int16_t ROMbank;
+    uint8_t WRAMbank;
+    uint8_t VRAMbank;
+    uint8_t CRAMenable;
+    uint8_t bankingMode;
+    uint8_t reserved[2];
+};
+static_assert(sizeof(MEMSection) == 28, "no padding in sections");
+void MemoryMaster::saveState(StateWriter& state){
+    MEMSection section{ROM0offset, ROM1offset, RAMoffset, WRAMoffset, VRAMoffset,
+                       ROMbank, WRAMbank, VRAMbank, CRAMenable, bankingMode, {}};
+    state.begin(STATE_ID('M', 'E', 'M', ' '));
+    state.put(section);
+    state.put(IS);
+    state.put(hdma);
+    state.put(RAM, isCGB ? 0x10000 : 0x2000);
+    state.put(VRAM, isCGB ? 2*VRAM_BANKSIZE : VRAM_BANKSIZE);
+    state.put(OAM, 0xA0);
+    state.put(IO, 0x100);
+    state.put(CRAM, CRAMsize);
+    state.end();
+}
+// Offsets are used as they are, out of range ones would read past ROM,
+// CRAM, WRAM or VRAM
+bool MemoryMaster::checkState(StateReader& state){
+    MEMSection section;
+    HDMAstate dma;
+    if (!state.begin(STATE_ID('M', 'E', 'M', ' ')) || !state.get(section)
+        || !state.skip(sizeof(IS)) || !state.get(dma)) return false;
+    int64_t ROMend = ROMsize;
+    return section.ROM0offset >= 0 && section.ROM0offset + ROM_BANKSIZE <= ROMend
+        && section.ROM1offset >= -ROM_BANKSIZE && section.ROM1offset + 2*ROM_BANKSIZE <= ROMend
+        && section.ROMbank >= 0 && section.ROMbank < totalROMbanks
+        && (section.RAMoffset == 0 || uint64_t(section.RAMoffset) + CRAM_BANKSIZE <= CRAMsize)
+        && section.WRAMbank >= 1 && section.WRAMbank <= (isCGB ? 7 : 1)
+        && section.WRAMoffset == section.WRAMbank * WRAM_BANKSIZE
+        && section.VRAMbank <= (isCGB ? 1 : 0)
+        && section.VRAMoffset == section.VRAMbank * VRAM_BANKSIZE
+        && (!dma.work || dma.dst >= 0x8000);
+}
+bool MemoryMaster::loadState(StateReader& state){
+    MEMSection section;
+    if (!state.begin(STATE_ID('M', 'E', 'M', ' ')) || !state.get(section)) return false;
+    ROM0offset = section.ROM0offset;
+    ROM1offset = section.ROM1offset;
+    RAMoffset = section.RAMoffset;
+    WRAMoffset = section.WRAMoffset;
+    VRAMoffset = section.VRAMoffset;
+    ROMbank = section.ROMbank;
+    WRAMbank = section.WRAMbank;
+    VRAMbank = section.VRAMbank;
+    CRAMenable = section.CRAMenable;
+    bankingMode = section.bankingMode;
+    return state.get(IS) && state.get(hdma)
+        && state.get(RAM, isCGB ? 0x10000 : 0x2000)
+        && state.get(VRAM, isCGB ? 2*VRAM_BANKSIZE : VRAM_BANKSIZE)
+        && state.get(OAM, 0xA0) && state.get(IO, 0x100)
+        && state.get(CRAM, CRAMsize);
+}
@@ -1,26 +1,145 @@
 #include <algorithm>
 #include <cstdint>
+#include <cstring>
 
 #include "../include/PPU.hpp"
 #include "../include/MEM.hpp"
-#include "../include/Display.hpp"
+#include "../include/Screen.hpp"
+#include "../include/Hash.hpp"
+#include "../include/ThreadPool.hpp"
+#include "../include/Scheduler.hpp"
 
-PPU::PPU(MemoryMaster& master, Window& window) : MEM(master),
-screen(window)
-{ }
+PPU::PPU(MemoryMaster& master, Screen& window) : MEM(master),
+IS(master.IS), screen(window)
+{
+    setColorMode(colorMode);
+}
+PPU::~PPU(){
+    delete pool;
+}
 
-void PPU::updateColor(uint32_t& color, uint16_t data){
-    uint8_t r = (data & 0x1F);
-    uint8_t g = (data >> 5) & 0x1F;
-    uint8_t b = (data >> 10) & 0x1F;
-    r = (r << 3) | (r >> 2);
-    g = (g << 3) | (g >> 2);
-    b = (b << 3) | (b >> 2);
-    color = (r<< 24) | (g << 16) | (b << 8) | 0xFF;
+// Palette writes and DMG shades are single loads from the table of the
+// current mode, switching modes recolors the CGB palettes in place.
+void PPU::setColorMode(ColorMode mode){
+    colorMode = mode;
+    colors = colorTable(mode);
+    shades = shadeTable(mode);
+    for (int id = 0; id < 32; id++){
+        self.BGcolorBuffer[id] = colors[BGP[id] & 0x7FFF];
+        self.OBcolorBuffer[id] = colors[OBP[id] & 0x7FFF];
+    }
+}
+ColorMode PPU::getColorMode(){
+    return colorMode;
+}
+
+// Frames go straight into the locked window texture unless the caller
+// supplied its own buffer (headless use). pitch is in pixels.
+void PPU::setFramebuffer(uint32_t* buffer, int pitch){
+    userFramebuffer = buffer;
+    framebuffer = buffer;
+    this->pitch = pitch;
+}
+// Optional second output with the palette index of every pixel:
+// DMG shade 0-3, or on CGB the BG (0-31) or OBJ (32-63) palette entry.
+void PPU::setIndexBuffer(uint8_t* buffer){
+    indexBuffer = buffer;
+}
+void PPU::setParallel(int threads){
+    if (pool) flushLines();
+    delete pool;
+    pool = nullptr;
+    if (threads < 0) return;
+    pool = new ThreadPool(threads);
+    lines.assign(SCH, LineJob());
+    version = 0;
+    versionUsed = false;
 }
+static int videoSize(bool isCGB){
+    return (isCGB ? 2*VRAM_BANKSIZE : VRAM_BANKSIZE) + 0xA0;
+}
+// Lines recorded against the live VRAM/OAM get a copy of it before it
+// changes, later lines move on to the next version.
+void PPU::videoWrite(){
+    if (!versionUsed) return;
+    int size = videoSize(MEM.isCGB);
+    if (versions.size() < size_t(version + 1) * size) versions.resize((version + 1) * size);
+    uint8_t* copy = versions.data() + version * size;
+    memcpy(copy, MEM.VRAMdata(), size - 0xA0);
+    memcpy(copy + size - 0xA0, MEM.OAMdata(), 0xA0);
+    version++;
+    versionUsed = false;
+}
+void PPU::recordLine(){
+    LineJob& job = lines[self.LY];
+    job.state = self;
+    job.wline = wline;
+    job.version = version;
+    job.valid = true;
+    versionUsed = true;
+}
+void PPU::flushLines(){
+    if (!framebuffer) framebuffer = screen.lockFrame(pitch);
+    int size = videoSize(MEM.isCGB);
+    int bands = std::min(pool->size() * 2, SCH);
+    pool->run(bands, [&](int band) {
+        for (int y = SCH * band / bands; y < SCH * (band + 1) / bands; y++){
+            LineJob& job = lines[y];
+            if (!job.valid) continue;
+            const uint8_t* vram = MEM.VRAMdata();
+            const uint8_t* oam = MEM.OAMdata();
+            if (job.version < version){
+                vram = versions.data() + job.version * size;
+                oam = vram + size - 0xA0;
+            }
+            uint8_t* indices = indexBuffer ? indexBuffer + y*SCW : nullptr;
+            LineRenderer(job.state, job.wline, vram, oam, MEM.isCGB)
+                .draw(framebuffer + y*pitch, indices, shades);
+            job.valid = false;
+        }
+    });
+    version = 0;
+    versionUsed = false;
+}
+uint32_t* PPU::frameLine(){
+    if (!framebuffer) framebuffer = screen.lockFrame(pitch);
+    return framebuffer + self.LY * pitch;
+}
+void PPU::blankFrame(){
+    // lines recorded before the LCD went off are covered by the blank frame
+    for (LineJob& job : lines) job.valid = false;
+    version = 0;
+    versionUsed = false;
+    if (hidden || dropping){
+        endFrame();
+        return;
+    }
+    if (!framebuffer) framebuffer = screen.lockFrame(pitch);
+    for (int y = 0; y < SCH; y++){
+        for (int x = 0; x < SCW; x++) framebuffer[y*pitch + x] = shades[0];
+    }
+    if (indexBuffer){
+        for (int i = 0; i < SCW*SCH; i++) indexBuffer[i] = 0;
+    }
+    endFrame();
+}
+void PPU::endFrame(){
+    if (!hidden){
+        if (hashFrames && !dropping){
+            if (!framebuffer) framebuffer = screen.lockFrame(pitch);
+            frameHash = hashFrame(framebuffer, pitch);
+        }
+        screen.show();
+        screen.poolEvents();
+    }
+    framebuffer = userFramebuffer;
+    frames++;
+    dropping = screen.dropNext;
+}
+
 void PPU::update(){
     IS.STAT = (IS.STAT&0b11111100)|MODE;
-    timeCounter = cost();
+    timeCounter += cost(MODE);
 }
 void PPU::setHBLANK(){
     if (IS.STAT & 0x08) IS.IF |= STAT;
@@ -43,7 +162,24 @@ void PPU::setDRAWING(){
     update();
 }
 
-void PPU::search(){
+// The window line counter only advances on lines that show the window
+void PPU::drawing(){
+    if (self.LY >= SCH) return;
+    if (!hidden && !dropping && pool){
+        recordLine();
+    }else if (!hidden && !dropping){
+        uint8_t* indices = indexBuffer ? indexBuffer + self.LY*SCW : nullptr;
+        LineRenderer(self, wline, MEM.VRAMdata(), MEM.OAMdata(), MEM.isCGB)
+            .draw(frameLine(), indices, shades);
+    }
+    if ((self.LCDC & 0x20) && self.LY >= self.WY && self.WX < 167) wline++;
+}
+
+LineRenderer::LineRenderer(const PPUState& state, uint8_t wline, const uint8_t* vram,
+                           const uint8_t* oam, bool isCGB) : self(state), VRAM(vram),
+OAM(oam), isCGB(isCGB), wline(wline)
+{ }
+void LineRenderer::search(){
     founds = 0;
     if (!(self.LCDC& 0x02)){
         return;
@@ -53,7 +189,7 @@ void PPU::search(){
     if (self.LCDC&0x4) sprite_height = 16;
     else sprite_height = 8;
     for (uint16_t id = 0xFE00; id < 0xFEA0; id+=4){
-        int16_t y = MEM.readOAM(id) - 16;
+        int16_t y = readOAM(id) - 16;
         if (self.LY >= y && self.LY < y + sprite_height){
             foundSprits[founds++] = id;
             if (founds == 10) return;
@@ -61,11 +197,11 @@ void PPU::search(){
     }
 
     // Sprite sorting by x coordinate. if coordinate the same - by address
-    if (!MEM.isCGB){
+    if (!isCGB){
         std::sort(foundSprits, foundSprits + founds,
         [this](uint16_t a, uint16_t b) {
-            uint8_t x0 = this->MEM.readOAM(a+1);
-            uint8_t x1 = this->MEM.readOAM(b+1);
+            uint8_t x0 = this->readOAM(a+1);
+            uint8_t x1 = this->readOAM(b+1);
             if (x0 != x1)
                 return x0 > x1;
             return a > b;
@@ -77,10 +213,10 @@ void PPU::search(){
         });
     }
 }
-void PPU::drawing(){
-    if (self.LY >= SCH) return;
+void LineRenderer::draw(uint32_t* line, uint8_t* indices, const uint32_t* shades){
+    search();
     bool isMaster = self.LCDC & 0x1;
-    if (!isMaster && !MEM.isCGB){
+    if (!isMaster && !isCGB){
         for (uint8_t x = 0; x < SCW; x++) BGlines[x] = 0;
     }else{
         render_BG_line();
@@ -92,33 +228,26 @@ void PPU::drawing(){
     if (self.LCDC&0x2){
         renderSprites();
     }
-    if (MEM.isCGB) {
-        int dy = self.LY*SCW;
+    if (isCGB) {
         for (uint8_t x = 0; x < SCW; x++){
             uint8_t Opx = OBlines[x];
             uint8_t Opd = Opx&0x3;
             uint8_t Bpx = BGlines[x];
             uint8_t Bpd = Bpx&0x3;
             uint8_t Bpp = Bpd+((Bpx>>2)&0x7)*4;
-
-            if (Opd == 0){
-                screen.setPixel(x, dy, self.BGcolorBuffer[Bpp]);
-                continue;
-            }
             uint8_t Opp = Opd+((Opx>>2)&0x7)*4;
-            uint32_t col;
-            if(isMaster){
-                if (Bpd == 0){
-                    col = self.OBcolorBuffer[Opp];
-                }else if ((Bpx & 0x80) | (Opx & 0x80)) {
-                    col = self.BGcolorBuffer[Bpp];
-                }else {
-                    col = self.OBcolorBuffer[Opp];
-                }
+
+            // BG wins over a sprite pixel only with master priority on,
+            // a non-zero BG color and a priority bit set on either side
+            bool sprite = Opd != 0 &&
+                !(isMaster && Bpd != 0 && ((Bpx & 0x80) | (Opx & 0x80)));
+            if (sprite){
+                line[x] = self.OBcolorBuffer[Opp];
+                if (indices) indices[x] = 32 + Opp;
             }else{
-                col = self.OBcolorBuffer[Opp];
+                line[x] = self.BGcolorBuffer[Bpp];
+                if (indices) indices[x] = Bpp;
             }
-            screen.setPixel(x, dy, col);
         }
     }else{
         for (uint8_t x = 0; x < SCW; x++){
@@ -127,16 +256,18 @@ void PPU::drawing(){
             uint8_t Opd = Opx&0x3;
             uint8_t Bpd = Bpx&0x3;
             
+            uint8_t px;
             if (Bpx == 0){
-                BGlines[x] = Opd;
+                px = Opd;
             }else if (Opx&0x80){
-                BGlines[x] = Bpd;
-            }else BGlines[x] = Opd;
+                px = Bpd;
+            }else px = Opd;
+            line[x] = shades[px];
+            if (indices) indices[x] = px;
         }
-        screen.drawLine(BGlines, self.LY);
     }
 }
-void PPU::renderSprites() {
+void LineRenderer::renderSprites() {
     uint8_t sprite_height;
     if (self.LCDC & 0x4) sprite_height = 16;
     else sprite_height = 8;
@@ -144,10 +275,10 @@ void PPU::renderSprites() {
     for (int i = 0; i < founds; i++){
         
         uint16_t addr = foundSprits[i];
-        int oam_y = self.LY - (MEM.readOAM(addr) - 16);
-        int oam_x = MEM.readOAM(addr+1) - 8;
-        uint8_t tile_num = MEM.readOAM(addr+2);
-        uint8_t flags = MEM.readOAM(addr+3);
+        int oam_y = self.LY - (readOAM(addr) - 16);
+        int oam_x = readOAM(addr+1) - 8;
+        uint8_t tile_num = readOAM(addr+2);
+        uint8_t flags = readOAM(addr+3);
 
         uint16_t tile_addr = 0x8000;
 
@@ -179,7 +310,7 @@ void PPU::renderSprites() {
         
         uint8_t lpalette = 0;
         uint8_t spritePalette = (flags&0x10) ? self.OBP1 : self.OBP0;
-        if (MEM.isCGB){
+        if (isCGB){
             lpalette = (flags & 0x7) << 2;
         }
         
@@ -187,11 +318,11 @@ void PPU::renderSprites() {
         uint8_t low_byte;
         uint8_t high_byte;
         if (flags & 0x08){
-            low_byte = MEM.readVRAM1(tile_line_offset);
-            high_byte = MEM.readVRAM1(tile_line_offset + 1);
+            low_byte = readVRAM1(tile_line_offset);
+            high_byte = readVRAM1(tile_line_offset + 1);
         }else{
-            low_byte = MEM.readVRAM0(tile_line_offset);
-            high_byte = MEM.readVRAM0(tile_line_offset + 1);
+            low_byte = readVRAM0(tile_line_offset);
+            high_byte = readVRAM0(tile_line_offset + 1);
         }
         
         uint8_t start_x = (oam_x < 0) ? static_cast<uint8_t>(-oam_x) : 0;
@@ -210,7 +341,7 @@ void PPU::renderSprites() {
             if (color == 0) continue;
             
             uint8_t final_color;
-            if (MEM.isCGB){
+            if (isCGB){
                 final_color = color;
             } else{
                 final_color = (spritePalette >> (color * 2)) & 3;
@@ -219,7 +350,7 @@ void PPU::renderSprites() {
         }
     }
 }
-void PPU::render_BG_line() {
+void LineRenderer::render_BG_line() {
     uint16_t tilemap_addr = (self.LCDC & 0x8) ? 0x9C00 : 0x9800;
     
     uint8_t scy = self.SCY;
@@ -232,7 +363,7 @@ void PPU::render_BG_line() {
         drawline(x, bg_x, bg_y, tilemap_addr);
     }
 }
-void PPU::render_window_line() {
+void LineRenderer::render_window_line() {
     int wx = (int)self.WX - 7;
     if (self.LY < self.WY || wx >= 160) {
         return;
@@ -245,14 +376,13 @@ void PPU::render_window_line() {
         
         drawline(x, win_x, wline, tilemap_addr);
     }
-    wline++;
 }
-void PPU::drawline(int& x, int dx, int dy, uint16_t tilemap){
+void LineRenderer::drawline(int& x, int dx, int dy, uint16_t tilemap){
     uint8_t tile_x = dx / 8;
     uint8_t tile_y = dy / 8;
     
     uint16_t tilemap_index = tilemap + tile_y * 32 + tile_x;
-    uint8_t tile_num = MEM.readVRAM0(tilemap_index);
+    uint8_t tile_num = readVRAM0(tilemap_index);
 
     uint16_t tile_addr;
     if (self.LCDC & 0x10) {
@@ -267,8 +397,8 @@ void PPU::drawline(int& x, int dx, int dy, uint16_t tilemap){
     uint8_t flags = 0;
     uint8_t lpalette = 0;
     uint8_t palette = self.BGP;
-    if (MEM.isCGB){
-        flags = MEM.readVRAM1(tilemap_index);
+    if (isCGB){
+        flags = readVRAM1(tilemap_index);
         lpalette = (flags & 0x07) << 2;
 
         if (flags & 0x40) {  // Y flip
@@ -281,11 +411,11 @@ void PPU::drawline(int& x, int dx, int dy, uint16_t tilemap){
     uint8_t low_byte;
     uint8_t high_byte;
     if ((flags & 0x08)){
-        low_byte = MEM.readVRAM1(tile_line_offset);
-        high_byte = MEM.readVRAM1(tile_line_offset + 1);
+        low_byte = readVRAM1(tile_line_offset);
+        high_byte = readVRAM1(tile_line_offset + 1);
     }else{
-        low_byte = MEM.readVRAM0(tile_line_offset);
-        high_byte = MEM.readVRAM0(tile_line_offset + 1);
+        low_byte = readVRAM0(tile_line_offset);
+        high_byte = readVRAM0(tile_line_offset + 1);
     }
     
     bool xFlip = flags & 0x20;
@@ -302,7 +432,7 @@ void PPU::drawline(int& x, int dx, int dy, uint16_t tilemap){
                         ((low_byte >> bit) & 1);
         
         uint8_t final_color;
-        if (MEM.isCGB){
+        if (isCGB){
             final_color = color;
         }else {
             final_color = (palette >> (color * 2)) & 3;
@@ -311,8 +441,8 @@ void PPU::drawline(int& x, int dx, int dy, uint16_t tilemap){
     }
 }
 
-int PPU::cost(){
-    switch (MODE) {
+int PPU::cost(int mode){
+    switch (mode) {
         case 0:
             return 204;
         case 1:
@@ -335,17 +465,41 @@ void PPU::checkLYC(){
     }
 }
 
-void PPU::step(int time){
-    if ( !(self.LCDC >> 7) )
-    { return; }
+// The PPU runs lazily: it only catches up at its scheduled deadline or
+// through sync() before anything touches PPU registers, VRAM or OAM.
+void PPU::setScheduler(Scheduler* master){
+    scheduler = master;
+    syncedTo = scheduler->now;
+    scheduler->schedule(EVENT_PPU, syncedTo + deadline);
+}
+void PPU::sync(){
+    int time = scheduler->now - syncedTo;
+    if (time == 0) return;
+    syncedTo = scheduler->now;
+    advance(time);
+    deadline -= time;
+    if (deadline <= 0) updateDeadline();
+}
+void PPU::advance(int time){
+    if ( !(self.LCDC >> 7) ){
+        // the screen stays blank, but frames keep coming at the same rate
+        offCounter += time;
+        while (offCounter >= FRAME_CYCLES){
+            offCounter -= FRAME_CYCLES;
+            blankFrame();
+        }
+        return;
+    }
     timeCounter -= time;
-    if (timeCounter <= 0){
-        timeCounter += cost();
+    while (timeCounter <= 0){
         switch (MODE) {
             case 0:
                 self.LY++;
                 checkLYC();
-                if (self.LY >= SCH) { setVBLANK(); }
+                if (self.LY >= SCH) {
+                    if (pool && !hidden && !dropping) flushLines();
+                    setVBLANK();
+                }
                 else setSEARCH();
                 MEM.HDMAstep();
                 break;
@@ -355,32 +509,91 @@ void PPU::step(int time){
                 if (self.LY > 153){
                     self.LY = 0;
                     wline = 0;
-                    screen.show();
+                    endFrame();
                     setSEARCH();
-                }
+                }else timeCounter += cost(MODE);
                 break;
             case 2:
-                search();
                 setDRAWING();
+                // drawing has elapsed as well, finish the whole line at once
+                if (timeCounter <= 0){
+                    drawing();
+                    setHBLANK();
+                }
                 break;
             case 3:
                 drawing();
                 setHBLANK();
-                screen.poolEvents();
                 break;
         }
     }
 }
+// Walks the mode schedule from the current state up to the first point
+// that raises an interrupt enabled in IE, runs an HDMA block or ends the frame.
+void PPU::updateDeadline(){
+    if ( !(self.LCDC >> 7) ){
+        deadline = FRAME_CYCLES - offCounter;
+        scheduler->schedule(EVENT_PPU, syncedTo + deadline);
+        return;
+    }
+    bool statOn = IS.IE & STAT;
+    bool hdma = MEM.HDMAactive();
+    uint8_t mode = MODE;
+    uint8_t ly = self.LY;
+    int time = timeCounter;
+    for (;;){
+        bool hit = false;
+        bool lyc;
+        switch (mode) {
+            case 0:
+                ly++;
+                lyc = ly == self.LYC && (IS.STAT & 0x40);
+                hit = hdma || (statOn && lyc);
+                if (ly >= SCH){
+                    mode = 1;
+                    hit |= (IS.IE & VBLANK) || (statOn && (IS.STAT & 0x10));
+                }else{
+                    mode = 2;
+                    hit |= statOn && (IS.STAT & 0x20);
+                }
+                break;
+            case 1:
+                ly++;
+                lyc = ly == self.LYC && (IS.STAT & 0x40);
+                hit = statOn && lyc;
+                if (ly > 153){ // frame end
+                    ly = 0;
+                    mode = 2;
+                    hit = true;
+                }
+                break;
+            case 2:
+                mode = 3;
+                break;
+            case 3:
+                mode = 0;
+                hit = statOn && (IS.STAT & 0x08);
+                break;
+        }
+        if (hit) break;
+        time += cost(mode);
+    }
+    deadline = time;
+    scheduler->schedule(EVENT_PPU, syncedTo + deadline);
+}
 bool PPU::write(uint16_t addr, uint8_t data){
     switch (addr) {
         case(0xFF40): // LCDC
+            if ((self.LCDC ^ data) & 0x80) offCounter = 0;
             self.LCDC = data;
             if ( !(self.LCDC & 0x80) )
             {
                 self.LY = 0;
                 wline = 0;
+                timeCounter = 0;
                 setHBLANK();
             }
+            updateDeadline();
             return true;
         case(0xFF42): // SCY
             self.SCY = data;
@@ -393,6 +606,7 @@ bool PPU::write(uint16_t addr, uint8_t data){
         case(0xFF45): // LYC
             self.LYC = data;
             checkLYC();
+            updateDeadline();
             return true;
         case(0xFF47): // BGP
             self.BGP = data;
@@ -420,7 +634,7 @@ bool PPU::write(uint16_t addr, uint8_t data){
                 }else{
                     BGP[id] = data;
                 }
-                updateColor(self.BGcolorBuffer[id], BGP[id]);
+                self.BGcolorBuffer[id] = colors[BGP[id] & 0x7FFF];
                 if (BGsrc&0x80){
                     BGsrc = ((BGsrc + 1) & 0x3F) | 0x80;
                 }
@@ -436,7 +650,7 @@ bool PPU::write(uint16_t addr, uint8_t data){
                 }else{
                     OBP[id] = data;
                 }
-                updateColor(self.OBcolorBuffer[id], OBP[id]);
+                self.OBcolorBuffer[id] = colors[OBP[id] & 0x7FFF];
                 if (OBsrc&0x80){
                     OBsrc = ((OBsrc + 1) & 0x3F) | 0x80;
                 }
@@ -490,4 +704,62 @@ bool PPU::read(uint16_t addr, uint8_t& data){
             return true;
     }
     return false;
-}
\ No newline at end of file
+}
+struct PPUSection{
+    uint64_t syncedTo;
+    int32_t MODE;
+    int32_t timeCounter;
+    int32_t deadline;
+    int32_t offCounter;
+    uint32_t frames;
+    uint8_t wline;
+    uint8_t BGsrc;
+    uint8_t OBsrc;
+    uint8_t reserved;
+};
+static_assert(sizeof(PPUSection) == 32, "no padding in sections");
+void PPU::saveState(StateWriter& state){
+    PPUSection section{syncedTo, MODE, timeCounter, deadline, offCounter, frames,
+                       wline, BGsrc, OBsrc, 0};
+    state.begin(STATE_ID('P', 'P', 'U', ' '));
+    state.put(section);
+    state.put(self);
+    state.put(BGP);
+    state.put(OBP);
+    state.end();
+}
+bool PPU::checkState(StateReader& state, uint64_t now){
+    PPUSection section;
+    PPUState registers;
+    if (!state.begin(STATE_ID('P', 'P', 'U', ' ')) || !state.get(section)
+        || !state.get(registers)) return false;
+    const int line = cost(1);
+    return section.MODE >= 0 && section.MODE <= 3 && registers.LY <= 153
+        && section.timeCounter >= -line && section.timeCounter <= line
+        && section.offCounter >= 0 && section.offCounter < FRAME_CYCLES
+        && section.deadline > 0 && section.deadline <= 2*FRAME_CYCLES
+        && section.syncedTo <= now && now - section.syncedTo <= 2*FRAME_CYCLES;
+}
+bool PPU::loadState(StateReader& state){
+    PPUSection section;
+    if (!state.begin(STATE_ID('P', 'P', 'U', ' ')) || !state.get(section)
+        || !state.get(self) || !state.get(BGP) || !state.get(OBP)) return false;
+    syncedTo = section.syncedTo;
+    MODE = section.MODE;
+    timeCounter = section.timeCounter;
+    deadline = section.deadline;
+    offCounter = section.offCounter;
+    frames = section.frames;
+    wline = section.wline;
+    BGsrc = section.BGsrc;
+    OBsrc = section.OBsrc;
+    // colors follow this machine's color mode, not the saving one's
+    setColorMode(colorMode);
+    for (LineJob& job : lines) job.valid = false;
+    version = 0;
+    versionUsed = false;
+    // the event follows from the counters, a stray saved time would leave
+    // the PPU waiting on a deadline that never comes
+    scheduler->schedule(EVENT_PPU, syncedTo + deadline);
+    return true;
+}
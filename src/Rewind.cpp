@@ -0,0 +1,188 @@
+#include <chrono>
+#include <cstring>
+
+#include "../include/Rewind.hpp"
+
+static double since(std::chrono::steady_clock::time_point begin){
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+    return elapsed.count();
+}
+
+// Deltas are mostly zero: they are stored as pairs of counts, zero bytes
+// to skip and literal bytes that follow, each count a 7 bit varint.
+static void putCount(std::vector<uint8_t>& out, size_t value){
+    while (value >= 0x80){
+        out.push_back(uint8_t(value) | 0x80);
+        value >>= 7;
+    }
+    out.push_back(uint8_t(value));
+}
+static size_t getCount(const uint8_t*& in){
+    size_t value = 0;
+    int shift = 0;
+    uint8_t byte;
+    do {
+        byte = *in++;
+        value |= size_t(byte & 0x7F) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+    return value;
+}
+static void compress(const uint8_t* data, size_t size, std::vector<uint8_t>& out){
+    out.clear();
+    size_t at = 0;
+    while (at < size){
+        size_t start = at;
+        uint64_t word;
+        while (at + 8 <= size && (memcpy(&word, data + at, 8), word == 0)) at += 8;
+        while (at < size && !data[at]) at++;
+        size_t zeros = at - start;
+        // literals stop at the first 8 zero bytes in a row
+        size_t begin = at;
+        int run = 0;
+        while (at < size && run < 8){
+            run = data[at] ? 0 : run + 1;
+            at++;
+        }
+        if (run == 8) at -= 8;
+        putCount(out, zeros);
+        putCount(out, at - begin);
+        out.insert(out.end(), data + begin, data + at);
+    }
+}
+// XORs a compressed delta into state
+static void expand(const std::vector<uint8_t>& packed, uint8_t* state){
+    const uint8_t* in = packed.data();
+    const uint8_t* end = in + packed.size();
+    size_t at = 0;
+    while (in < end){
+        at += getCount(in);
+        size_t count = getCount(in);
+        for (size_t i = 0; i < count; i++) state[at + i] ^= in[i];
+        in += count;
+        at += count;
+    }
+}
+
+Rewind::Rewind(GameBoy& machine, int interval, size_t budget) : GB(machine),
+interval(interval < 1 ? 1 : interval), budget(budget)
+{
+    worker = std::thread(&Rewind::work, this);
+}
+Rewind::~Rewind(){
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stop = true;
+    }
+    wake.notify_all();
+    worker.join();
+}
+void Rewind::work(){
+    std::unique_lock<std::mutex> guard(lock);
+    for (;;){
+        wake.wait(guard, [this] { return stop || !pending.empty(); });
+        if (stop) return;
+        std::vector<uint8_t> state = std::move(pending.front());
+        pending.pop_front();
+        busy = true;
+        guard.unlock();
+        store(state);
+        guard.lock();
+        spare.push_back(std::move(state));
+        busy = false;
+        if (pending.empty()) idle.notify_all();
+    }
+}
+// Worker side: the old head turns into a delta against the new one
+void Rewind::store(std::vector<uint8_t>& state){
+    if (head.size() != state.size()){
+        head.swap(state);
+        return;
+    }
+    auto begin = std::chrono::steady_clock::now();
+    size_t size = state.size();
+    delta.resize(size);
+    for (size_t i = 0; i < size; i++) delta[i] = head[i] ^ state[i];
+    std::vector<uint8_t> packed;
+    compress(delta.data(), size, packed);
+    packed.shrink_to_fit();
+    head.swap(state);
+
+    std::lock_guard<std::mutex> guard(lock);
+    historyBytes += packed.size();
+    stats.rawBytes += size;
+    stats.storedBytes += packed.size();
+    history.push_back(std::move(packed));
+    while (historyBytes > budget && !history.empty()){
+        historyBytes -= history.front().size();
+        history.pop_front();
+    }
+    stats.compressSeconds += since(begin);
+}
+void Rewind::settle(){
+    std::unique_lock<std::mutex> guard(lock);
+    idle.wait(guard, [this] { return pending.empty() && !busy; });
+}
+
+void Rewind::frame(){
+    atHead = false;
+    if (++counter < interval) return;
+    counter = 0;
+    auto begin = std::chrono::steady_clock::now();
+    if (!stateBytes) stateBytes = GB.stateSize();
+    std::vector<uint8_t> state;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (!spare.empty()){
+            state = std::move(spare.back());
+            spare.pop_back();
+        }
+    }
+    state.resize(stateBytes);
+    GB.saveState(state.data(), stateBytes);
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        pending.push_back(std::move(state));
+        stats.captures++;
+        stats.captureSeconds += since(begin);
+    }
+    wake.notify_one();
+}
+bool Rewind::stepBack(){
+    settle();
+    if (head.empty()) return false;
+    auto begin = std::chrono::steady_clock::now();
+    bool moved = !atHead || !history.empty();
+    if (atHead && moved){
+        std::lock_guard<std::mutex> guard(lock);
+        expand(history.back(), head.data());
+        historyBytes -= history.back().size();
+        history.pop_back();
+    }
+    GB.loadState(head.data(), head.size());
+    atHead = true;
+    counter = 0;
+    stats.steps++;
+    stats.stepSeconds += since(begin);
+    return moved;
+}
+void Rewind::clear(){
+    settle();
+    std::lock_guard<std::mutex> guard(lock);
+    history.clear();
+    historyBytes = 0;
+    head.clear();
+    atHead = false;
+    counter = 0;
+    stateBytes = 0;
+}
+size_t Rewind::size(){
+    settle();
+    std::lock_guard<std::mutex> guard(lock);
+    return history.size() + !head.empty();
+}
+size_t Rewind::bytes(){
+    settle();
+    std::lock_guard<std::mutex> guard(lock);
+    return historyBytes + head.size();
+}
@@ -0,0 +1,104 @@
+#include <chrono>
+#include <iostream>
+
+#include "../include/RunAhead.hpp"
+
+static double since(std::chrono::steady_clock::time_point begin){
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+    return elapsed.count();
+}
+
+// The second machine draws to and polls the real screen but has a joypad
+// of its own, which follows the real one
+class AheadScreen : public Screen{
+    Screen& target;
+public:
+    AheadScreen(Screen& screen) : target(screen) { }
+    uint32_t* lockFrame(int& pitch) override { return target.lockFrame(pitch); }
+    void show() override { target.show(); }
+    void poolEvents() override { target.poolEvents(); }
+    bool isOpen() override { return target.isOpen(); }
+};
+struct AheadMachine{
+    AheadScreen screen;
+    GameBoy GB;
+
+    AheadMachine(Screen& target) : screen(target), GB(screen) { }
+};
+
+RunAhead::RunAhead(GameBoy& machine, int frames, bool withSecond) : GB(machine),
+count(frames < 0 ? 0 : frames)
+{
+    if (!withSecond || !count) return;
+    const RomImage* image = GB.MEM.image();
+    if (!image){
+        std::cerr << "run-ahead: no rom for a second machine\n";
+        return;
+    }
+    second = new AheadMachine(GB.context);
+    second->GB.MEM.verbose = false;
+    second->GB.MEM.saveFile = false;
+    if (!second->GB.MEM.load(*image)){
+        delete second;
+        second = nullptr;
+        return;
+    }
+    second->GB.GC.setColorMode(GB.GC.getColorMode());
+    second->GB.GC.hashFrames = GB.GC.hashFrames;
+    second->GB.init();
+}
+RunAhead::~RunAhead(){
+    delete second;
+}
+void RunAhead::runAhead(GameBoy& machine){
+    for (int i = 0; i < count; i++){
+        machine.GC.hidden = i + 1 < count;
+        machine.runFrame();
+    }
+}
+void RunAhead::frame(){
+    if (!count){
+        GB.runFrame();
+        return;
+    }
+    auto begin = std::chrono::steady_clock::now();
+    GB.GC.hidden = true;
+    GB.runFrame();
+    stats.frameSeconds += since(begin);
+
+    begin = std::chrono::steady_clock::now();
+    if (state.empty()) state.resize(GB.stateSize());
+    GB.saveState(state.data(), state.size());
+    stats.saveSeconds += since(begin);
+
+    Joypad& joypad = GB.context.joypad;
+    if (second){
+        begin = std::chrono::steady_clock::now();
+        second->GB.loadState(state.data(), state.size());
+        second->screen.joypad.directions = joypad.directions;
+        second->screen.joypad.buttons = joypad.buttons;
+        stats.loadSeconds += since(begin);
+        begin = std::chrono::steady_clock::now();
+        runAhead(second->GB);
+        stats.aheadSeconds += since(begin);
+    }else{
+        // the frames ahead are heard when they happen for real
+        begin = std::chrono::steady_clock::now();
+        AudioSink* sink = GB.AP.getSink();
+        uint8_t directions = joypad.directions;
+        uint8_t buttons = joypad.buttons;
+        GB.AP.setSink(nullptr);
+        runAhead(GB);
+        GB.AP.setSink(sink);
+        stats.aheadSeconds += since(begin);
+        begin = std::chrono::steady_clock::now();
+        GB.loadState(state.data(), state.size());
+        // the shown frame polled input the real machine has not seen yet
+        if (joypad.directions != directions || joypad.buttons != buttons) joypad.update();
+        stats.loadSeconds += since(begin);
+    }
+    stats.frames++;
+}
+GameBoy& RunAhead::shown(){
+    return second && count ? second->GB : GB;
+}
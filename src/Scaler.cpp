@@ -0,0 +1,356 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#include "../include/Scaler.hpp"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// t/256 of b over a, two channels per 32 bit multiply
+static inline uint32_t mix(uint32_t a, uint32_t b, uint32_t t){
+    uint32_t a0 = a & 0x00FF00FF;
+    uint32_t a1 = (a >> 8) & 0x00FF00FF;
+    uint32_t b0 = b & 0x00FF00FF;
+    uint32_t b1 = (b >> 8) & 0x00FF00FF;
+    uint32_t r0 = ((a0 * (256 - t) + b0 * t) >> 8) & 0x00FF00FF;
+    uint32_t r1 = (a1 * (256 - t) + b1 * t) & 0xFF00FF00;
+    return r0 | r1;
+}
+static inline uint32_t toYUV(uint32_t p){
+    int r = p >> 24;
+    int g = (p >> 16) & 0xFF;
+    int b = (p >> 8) & 0xFF;
+    int Y = (r + g + b) >> 2;
+    int U = ((r - b) >> 2) + 128;
+    int V = ((g + g - r - b) >> 3) + 128;
+    return (Y << 16) | (U << 8) | V;
+}
+static inline int distance(uint32_t a, uint32_t b){
+    int dy = std::abs(int(a >> 16) - int(b >> 16));
+    int du = std::abs(int((a >> 8) & 0xFF) - int((b >> 8) & 0xFF));
+    int dv = std::abs(int(a & 0xFF) - int(b & 0xFF));
+    return 48*dy + 7*du + 6*dv;
+}
+static inline bool similar(uint32_t a, uint32_t b){
+    return std::abs(int(a >> 16) - int(b >> 16)) <= 36 &&
+           std::abs(int((a >> 8) & 0xFF) - int((b >> 8) & 0xFF)) <= 7 &&
+           std::abs(int(a & 0xFF) - int(b & 0xFF)) <= 6;
+}
+
+static void nearestRows(const uint32_t* src, int pitch, uint32_t* dst, int dstPitch,
+                        int n, int y0, int y1){
+    for (int y = y0; y < y1; y++){
+        const uint32_t* row = src + y*pitch;
+        uint32_t* out = dst + y*n*dstPitch;
+        for (int x = 0; x < SCW; x++){
+            for (int i = 0; i < n; i++) out[x*n + i] = row[x];
+        }
+        for (int j = 1; j < n; j++){
+            memcpy(out + j*dstPitch, out, SCW*n*sizeof(uint32_t));
+        }
+    }
+}
+
+// Scale2x / AdvMAME2x, width x height source
+static void scale2xPixel(uint32_t B, uint32_t D, uint32_t E, uint32_t F, uint32_t H,
+                         uint32_t* out0, uint32_t* out1){
+    out0[0] = (D == B && B != F && D != H) ? D : E;
+    out0[1] = (B == F && B != D && F != H) ? F : E;
+    out1[0] = (D == H && D != B && H != F) ? D : E;
+    out1[1] = (H == F && D != H && B != F) ? F : E;
+}
+static void scale2xRows(const uint32_t* src, int width, int height, int pitch,
+                        uint32_t* dst, int dstPitch, int y0, int y1){
+    for (int y = y0; y < y1; y++){
+        const uint32_t* row = src + y*pitch;
+        const uint32_t* up = (y > 0) ? row - pitch : row;
+        const uint32_t* down = (y < height - 1) ? row + pitch : row;
+        uint32_t* out0 = dst + 2*y*dstPitch;
+        uint32_t* out1 = out0 + dstPitch;
+
+        scale2xPixel(up[0], row[0], row[0], row[1], down[0], out0, out1);
+        int x = 1;
+#if defined(__SSE2__)
+        for (; x + 4 < width; x += 4){
+            __m128i B = _mm_loadu_si128((const __m128i*)(up + x));
+            __m128i D = _mm_loadu_si128((const __m128i*)(row + x - 1));
+            __m128i E = _mm_loadu_si128((const __m128i*)(row + x));
+            __m128i F = _mm_loadu_si128((const __m128i*)(row + x + 1));
+            __m128i H = _mm_loadu_si128((const __m128i*)(down + x));
+            __m128i DB = _mm_cmpeq_epi32(D, B);
+            __m128i BF = _mm_cmpeq_epi32(B, F);
+            __m128i DH = _mm_cmpeq_epi32(D, H);
+            __m128i HF = _mm_cmpeq_epi32(H, F);
+
+            __m128i c0 = _mm_andnot_si128(_mm_or_si128(BF, DH), DB);
+            __m128i c1 = _mm_andnot_si128(_mm_or_si128(DB, HF), BF);
+            __m128i c2 = _mm_andnot_si128(_mm_or_si128(DB, HF), DH);
+            __m128i c3 = _mm_andnot_si128(_mm_or_si128(DH, BF), HF);
+            __m128i E0 = _mm_or_si128(_mm_and_si128(c0, D), _mm_andnot_si128(c0, E));
+            __m128i E1 = _mm_or_si128(_mm_and_si128(c1, F), _mm_andnot_si128(c1, E));
+            __m128i E2 = _mm_or_si128(_mm_and_si128(c2, D), _mm_andnot_si128(c2, E));
+            __m128i E3 = _mm_or_si128(_mm_and_si128(c3, F), _mm_andnot_si128(c3, E));
+
+            _mm_storeu_si128((__m128i*)(out0 + 2*x), _mm_unpacklo_epi32(E0, E1));
+            _mm_storeu_si128((__m128i*)(out0 + 2*x + 4), _mm_unpackhi_epi32(E0, E1));
+            _mm_storeu_si128((__m128i*)(out1 + 2*x), _mm_unpacklo_epi32(E2, E3));
+            _mm_storeu_si128((__m128i*)(out1 + 2*x + 4), _mm_unpackhi_epi32(E2, E3));
+        }
+#endif
+        for (; x < width; x++){
+            uint32_t F = (x < width - 1) ? row[x + 1] : row[x];
+            scale2xPixel(up[x], row[x - 1], row[x], F, down[x], out0 + 2*x, out1 + 2*x);
+        }
+    }
+}
+
+// Scale3x / AdvMAME3x
+static void scale3xRows(const uint32_t* src, int pitch, uint32_t* dst, int dstPitch,
+                        int y0, int y1){
+    for (int y = y0; y < y1; y++){
+        const uint32_t* row = src + y*pitch;
+        const uint32_t* up = (y > 0) ? row - pitch : row;
+        const uint32_t* down = (y < SCH - 1) ? row + pitch : row;
+        uint32_t* out0 = dst + 3*y*dstPitch;
+        uint32_t* out1 = out0 + dstPitch;
+        uint32_t* out2 = out1 + dstPitch;
+        for (int x = 0; x < SCW; x++){
+            int l = (x > 0) ? x - 1 : x;
+            int r = (x < SCW - 1) ? x + 1 : x;
+            uint32_t A = up[l], B = up[x], C = up[r];
+            uint32_t D = row[l], E = row[x], F = row[r];
+            uint32_t G = down[l], H = down[x], I = down[r];
+
+            bool db = D == B && B != F && D != H;
+            bool bf = B == F && B != D && F != H;
+            bool dh = D == H && D != B && H != F;
+            bool hf = H == F && D != H && B != F;
+            uint32_t* o = out0 + 3*x;
+            o[0] = db ? D : E;
+            o[1] = ((db && E != C) || (bf && E != A)) ? B : E;
+            o[2] = bf ? F : E;
+            o = out1 + 3*x;
+            o[0] = ((db && E != G) || (dh && E != A)) ? D : E;
+            o[1] = E;
+            o[2] = ((bf && E != I) || (hf && E != C)) ? F : E;
+            o = out2 + 3*x;
+            o[0] = dh ? D : E;
+            o[1] = ((dh && E != I) || (hf && E != G)) ? H : E;
+            o[2] = hf ? F : E;
+        }
+    }
+}
+
+Upscaler::Upscaler(ScaleFilter filter, int factor, int threads) : filter(filter),
+factor(factor), pool(threads)
+{
+    int low = (filter == FILTER_NEAREST) ? 1 : 2;
+    this->factor = factor = std::clamp(factor, low, 4);
+    yuv.resize(SCW*SCH);
+    if (filter == FILTER_SCALEX && factor == 4) temp.resize(SCW*SCH*4);
+
+    // Subpixel centers in -1..1 relative to the source pixel. Blending
+    // toward an edge grows past the diagonal |fx| + |fy| = 1 of the quadrant.
+    for (int j = 0; j < factor; j++){
+        for (int i = 0; i < factor; i++){
+            double fx = double(2*i + 1 - factor) / factor;
+            double fy = double(2*j + 1 - factor) / factor;
+            quadrant.push_back((fx > 0) | ((fy > 0) << 1));
+            if (fx == 0 || fy == 0){
+                edgeWeight.push_back(0);
+                cornerWeight.push_back(0);
+                continue;
+            }
+            double edge = std::clamp(std::fabs(fx) + std::fabs(fy) - 0.5, 0.0, 1.0);
+            edgeWeight.push_back(uint16_t(std::lround(edge * 256)));
+            cornerWeight.push_back(uint16_t(std::lround(std::fabs(fx * fy) * 128)));
+        }
+    }
+}
+int Upscaler::scaleFactor(){
+    return factor;
+}
+void Upscaler::bands(int rows, const std::function<void(int, int)>& task){
+    int count = std::min(pool.size(), rows);
+    pool.run(count, [&](int band) {
+        task(rows * band / count, rows * (band + 1) / count);
+    });
+}
+void Upscaler::yuvRows(const uint32_t* src, int pitch, int y0, int y1){
+    for (int y = y0; y < y1; y++){
+        const uint32_t* row = src + y*pitch;
+        uint32_t* out = yuv.data() + y*SCW;
+        int x = 0;
+#if defined(__SSE2__)
+        const __m128i mask = _mm_set1_epi32(0xFF);
+        const __m128i bias = _mm_set1_epi32(128);
+        for (; x + 4 <= SCW; x += 4){
+            __m128i p = _mm_loadu_si128((const __m128i*)(row + x));
+            __m128i r = _mm_srli_epi32(p, 24);
+            __m128i g = _mm_and_si128(_mm_srli_epi32(p, 16), mask);
+            __m128i b = _mm_and_si128(_mm_srli_epi32(p, 8), mask);
+            __m128i Y = _mm_srli_epi32(_mm_add_epi32(_mm_add_epi32(r, g), b), 2);
+            __m128i U = _mm_add_epi32(_mm_srai_epi32(_mm_sub_epi32(r, b), 2), bias);
+            __m128i V = _mm_add_epi32(_mm_srai_epi32(
+                _mm_sub_epi32(_mm_add_epi32(g, g), _mm_add_epi32(r, b)), 3), bias);
+            __m128i packed = _mm_or_si128(_mm_or_si128(_mm_slli_epi32(Y, 16),
+                                          _mm_slli_epi32(U, 8)), V);
+            _mm_storeu_si128((__m128i*)(out + x), packed);
+        }
+#endif
+        for (; x < SCW; x++) out[x] = toYUV(row[x]);
+    }
+}
+
+// hqx-class: a quadrant whose two side neighbors agree with each other
+// but not with the center gets the edge blended in, a lone differing
+// diagonal is softened a little.
+void Upscaler::hqRows(const uint32_t* src, int pitch, uint32_t* dst, int dstPitch,
+                      int y0, int y1){
+    int n = factor;
+    for (int y = y0; y < y1; y++){
+        int up = (y > 0) ? y - 1 : y;
+        int down = (y < SCH - 1) ? y + 1 : y;
+        for (int x = 0; x < SCW; x++){
+            int left = (x > 0) ? x - 1 : x;
+            int right = (x < SCW - 1) ? x + 1 : x;
+            auto color = [&](int px, int py) { return src[py*pitch + px]; };
+            auto luma = [&](int px, int py) { return yuv[py*SCW + px]; };
+
+            uint32_t E = color(x, y);
+            uint32_t e = luma(x, y);
+            uint32_t target[4];
+            uint8_t kind[4];
+            for (int q = 0; q < 4; q++){
+                int sx = (q & 1) ? right : left;
+                int sy = (q & 2) ? down : up;
+                uint32_t X = luma(sx, y), Y = luma(x, sy), Z = luma(sx, sy);
+                kind[q] = 0;
+                if (similar(X, Y) && !similar(e, X) && !similar(e, Y)){
+                    target[q] = mix(color(sx, y), color(x, sy), 128);
+                    kind[q] = 1;
+                }else if (!similar(e, Z) && similar(e, X) && similar(e, Y)){
+                    target[q] = color(sx, sy);
+                    kind[q] = 2;
+                }
+            }
+            uint32_t* out = dst + y*n*dstPitch + x*n;
+            for (int j = 0, k = 0; j < n; j++){
+                for (int i = 0; i < n; i++, k++){
+                    int q = quadrant[k];
+                    uint32_t t = (kind[q] == 1) ? edgeWeight[k] :
+                                 (kind[q] == 2) ? cornerWeight[k] : 0;
+                    out[j*dstPitch + i] = t ? mix(E, target[q], t) : E;
+                }
+            }
+        }
+    }
+}
+
+// xBR-class (level 1): each corner compares the weighted YUV distances
+// along both diagonals over a 5x5 neighborhood and, when the edge runs
+// across the corner, blends the closer side neighbor in past the diagonal.
+void Upscaler::xbrRows(const uint32_t* src, int pitch, uint32_t* dst, int dstPitch,
+                       int y0, int y1){
+    int n = factor;
+    for (int y = y0; y < y1; y++){
+        for (int x = 0; x < SCW; x++){
+            auto index = [&](int dx, int dy) {
+                int px = std::clamp(x + dx, 0, SCW - 1);
+                int py = std::clamp(y + dy, 0, SCH - 1);
+                return std::make_pair(px, py);
+            };
+            auto color = [&](int dx, int dy) {
+                auto p = index(dx, dy);
+                return src[p.second*pitch + p.first];
+            };
+            auto luma = [&](int dx, int dy) {
+                auto p = index(dx, dy);
+                return yuv[p.second*SCW + p.first];
+            };
+
+            uint32_t E = color(0, 0);
+            uint32_t target[4];
+            bool edge[4];
+            for (int q = 0; q < 4; q++){
+                int sx = (q & 1) ? 1 : -1;
+                int sy = (q & 2) ? 1 : -1;
+                edge[q] = false;
+                uint32_t cF = color(sx, 0), cH = color(0, sy);
+                if (E == cF || E == cH) continue;
+
+                uint32_t e = luma(0, 0), F = luma(sx, 0), H = luma(0, sy), I = luma(sx, sy);
+                uint32_t B = luma(0, -sy), D = luma(-sx, 0);
+                uint32_t C = luma(sx, -sy), G = luma(-sx, sy);
+                uint32_t F4 = luma(2*sx, 0), H5 = luma(0, 2*sy);
+                uint32_t I4 = luma(2*sx, sy), I5 = luma(sx, 2*sy);
+
+                int across = distance(e, C) + distance(e, G) + distance(I, H5) +
+                             distance(I, F4) + 4*distance(H, F);
+                int along = distance(H, D) + distance(H, I5) + distance(F, I4) +
+                            distance(F, B) + 4*distance(e, I);
+                if (across < along){
+                    target[q] = (distance(e, F) <= distance(e, H)) ? cF : cH;
+                    edge[q] = true;
+                }
+            }
+            uint32_t* out = dst + y*n*dstPitch + x*n;
+            for (int j = 0, k = 0; j < n; j++){
+                for (int i = 0; i < n; i++, k++){
+                    int q = quadrant[k];
+                    uint32_t t = edge[q] ? edgeWeight[k] : 0;
+                    out[j*dstPitch + i] = t ? mix(E, target[q], t) : E;
+                }
+            }
+        }
+    }
+}
+
+void Upscaler::scale(const uint32_t* src, int srcPitch, uint32_t* dst, int dstPitch){
+    switch (filter) {
+        case FILTER_SCALEX:
+            if (factor == 2){
+                bands(SCH, [&](int y0, int y1) {
+                    scale2xRows(src, SCW, SCH, srcPitch, dst, dstPitch, y0, y1);
+                });
+            }else if (factor == 3){
+                bands(SCH, [&](int y0, int y1) {
+                    scale3xRows(src, srcPitch, dst, dstPitch, y0, y1);
+                });
+            }else{
+                uint32_t* half = temp.data();
+                bands(SCH, [&](int y0, int y1) {
+                    scale2xRows(src, SCW, SCH, srcPitch, half, SCW*2, y0, y1);
+                });
+                bands(SCH*2, [&](int y0, int y1) {
+                    scale2xRows(half, SCW*2, SCH*2, SCW*2, dst, dstPitch, y0, y1);
+                });
+            }
+            break;
+        case FILTER_HQ:
+        case FILTER_XBR:
+            bands(SCH, [&](int y0, int y1) { yuvRows(src, srcPitch, y0, y1); });
+            bands(SCH, [&](int y0, int y1) {
+                if (filter == FILTER_HQ) hqRows(src, srcPitch, dst, dstPitch, y0, y1);
+                else xbrRows(src, srcPitch, dst, dstPitch, y0, y1);
+            });
+            break;
+        default:
+            bands(SCH, [&](int y0, int y1) {
+                nearestRows(src, srcPitch, dst, dstPitch, factor, y0, y1);
+            });
+            break;
+    }
+}
+
+bool parseScaleFilter(const char* name, ScaleFilter& filter){
+    if (!strcmp(name, "nearest")) filter = FILTER_NEAREST;
+    else if (!strcmp(name, "scalex")) filter = FILTER_SCALEX;
+    else if (!strcmp(name, "hq")) filter = FILTER_HQ;
+    else if (!strcmp(name, "xbr")) filter = FILTER_XBR;
+    else return false;
+    return true;
+}
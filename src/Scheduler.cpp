@@ -0,0 +1,91 @@
+#include "../include/Scheduler.hpp"
+
+Scheduler::Scheduler(){
+    for (int i = 0; i < EVENT_COUNT; i++) slot[i] = -1;
+}
+bool Scheduler::before(const Event& a, const Event& b){
+    return a.time < b.time || (a.time == b.time && a.type < b.type);
+}
+void Scheduler::place(int index, const Event& event){
+    heap[index] = event;
+    slot[event.type] = index;
+}
+void Scheduler::up(int index){
+    Event event = heap[index];
+    while (index > 0){
+        int parent = (index - 1) / 2;
+        if (!before(event, heap[parent])) break;
+        place(index, heap[parent]);
+        index = parent;
+    }
+    place(index, event);
+}
+void Scheduler::down(int index){
+    Event event = heap[index];
+    for (;;){
+        int child = index * 2 + 1;
+        if (child >= count) break;
+        if (child + 1 < count && before(heap[child + 1], heap[child])) child++;
+        if (!before(heap[child], event)) break;
+        place(index, heap[child]);
+        index = child;
+    }
+    place(index, event);
+}
+void Scheduler::remove(int index){
+    slot[heap[index].type] = -1;
+    if (--count == index) return;
+    uint8_t moved = heap[count].type;
+    place(index, heap[count]);
+    up(index);
+    down(slot[moved]);
+}
+void Scheduler::schedule(EventType type, uint64_t time){
+    int index = slot[type];
+    if (index < 0){
+        index = count++;
+    }
+    place(index, {time, uint8_t(type)});
+    up(index);
+    down(slot[type]);
+}
+void Scheduler::cancel(EventType type){
+    if (slot[type] >= 0) remove(slot[type]);
+}
+bool Scheduler::pop(EventType& type){
+    if (!count || heap[0].time > now) return false;
+    type = EventType(heap[0].type);
+    remove(0);
+    return true;
+}
+void Scheduler::saveState(StateWriter& state){
+    uint64_t times[EVENT_COUNT];
+    for (int type = 0; type < EVENT_COUNT; type++){
+        times[type] = slot[type] < 0 ? UINT64_MAX : heap[slot[type]].time;
+    }
+    state.begin(STATE_ID('S', 'C', 'H', 'D'));
+    state.put(now);
+    state.put(times);
+    state.end();
+}
+bool Scheduler::checkState(StateReader& state, uint64_t& now){
+    uint64_t times[EVENT_COUNT];
+    if (!state.begin(STATE_ID('S', 'C', 'H', 'D')) || !state.get(now) || !state.get(times))
+        return false;
+    for (int type = 0; type < EVENT_COUNT; type++){
+        if (times[type] == UINT64_MAX) continue;
+        if (times[type] < now || times[type] - now > STATE_HORIZON) return false;
+    }
+    return true;
+}
+bool Scheduler::loadState(StateReader& state){
+    uint64_t times[EVENT_COUNT];
+    if (!state.begin(STATE_ID('S', 'C', 'H', 'D')) || !state.get(now) || !state.get(times))
+        return false;
+    count = 0;
+    for (int type = 0; type < EVENT_COUNT; type++) slot[type] = -1;
+    for (int type = 0; type < EVENT_COUNT; type++){
+        if (times[type] != UINT64_MAX) schedule(EventType(type), times[type]);
+    }
+    return true;
+}
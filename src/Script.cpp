@@ -0,0 +1,67 @@
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "../include/Script.hpp"
+
+static bool parseButton(const std::string& name, InputEvent& event){
+    static const char* buttons[4] = {"A", "B", "SELECT", "START"};
+    static const char* directions[4] = {"RIGHT", "LEFT", "UP", "DOWN"};
+    for (int i = 0; i < 4; i++){
+        if (name == buttons[i]){
+            event.buttons &= ~(1 << i);
+            return true;
+        }
+        if (name == directions[i]){
+            event.directions &= ~(1 << i);
+            return true;
+        }
+    }
+    return false;
+}
+bool InputScript::load(const char* filename){
+    std::ifstream file(filename);
+    if (!file.is_open()) {
+        std::cerr << "Error opening input script\n";
+        return false;
+    }
+    events.clear();
+    next = 0;
+
+    std::string line;
+    int number = 0;
+    while (std::getline(file, line)){
+        number++;
+        line = line.substr(0, line.find('#'));
+        std::istringstream words(line);
+        InputEvent event{0, 0xF, 0xF};
+        if (!(words >> event.frame)) continue;
+
+        std::string name;
+        while (words >> name){
+            std::transform(name.begin(), name.end(), name.begin(), ::toupper);
+            if (!parseButton(name, event)){
+                std::cerr << filename << ":" << number << ": unknown button " << name << "\n";
+                return false;
+            }
+        }
+        events.push_back(event);
+    }
+    std::stable_sort(events.begin(), events.end(),
+    [](const InputEvent& a, const InputEvent& b) {
+        return a.frame < b.frame;
+    });
+    return true;
+}
+void InputScript::apply(uint32_t frame, Joypad& joypad){
+    bool changed = false;
+    while (next < events.size() && events[next].frame <= frame){
+        joypad.directions = events[next].directions;
+        joypad.buttons = events[next].buttons;
+        changed = true;
+        next++;
+    }
+    if (changed) joypad.update();
+}
@@ -0,0 +1,141 @@
+#include <algorithm>
+
+#include "../include/Serial.hpp"
+#include "../include/Scheduler.hpp"
+
+void Serial::setScheduler(Scheduler* master){
+    scheduler = master;
+}
+void Serial::setInterrupts(InterruptState* master){
+    IS = master;
+}
+void Serial::setLink(LinkTransport* transport){
+    link = transport;
+    reschedule();
+}
+void Serial::handle(const LinkMessage& message){
+    peerTime = std::max(peerTime, message.time);
+    if (message.type == LINK_DATA) clocked.push_back(message);
+    else if (message.type == LINK_REPLY){
+        reply = message.data;
+        replied = true;
+    }
+}
+// Answers the peer's clock pulses this side has caught up with. The
+// shift register only moves while a transfer on the external clock waits.
+void Serial::answer(){
+    uint64_t now = scheduler->now;
+    while (!clocked.empty() && clocked.front().time <= now){
+        bool waiting = (SC & 0x81) == 0x80;
+        link->send({now, LINK_REPLY, waiting ? SB : uint8_t(0xFF)});
+        if (waiting){
+            SB = clocked.front().data;
+            SC &= 0x7F;
+            IS->IF |= SERIAL;
+        }
+        clocked.pop_front();
+    }
+}
+// Drains the cable and holds back while too far ahead. Pulses are
+// answered before waiting, the peer may be waiting for the reply.
+void Serial::exchange(){
+    uint64_t now = scheduler->now;
+    if (now - sentTime >= LINK_WINDOW / 2){
+        link->send({now, LINK_TIME, 0});
+        sentTime = now;
+    }
+    LinkMessage message;
+    while (link->receive(message, false)) handle(message);
+    answer();
+    while (now > peerTime + LINK_WINDOW && link->connected()){
+        if (link->receive(message, true)) handle(message);
+        answer();
+    }
+}
+void Serial::complete(uint8_t data){
+    SB = data;
+    SC &= 0x7F;
+    transfer = false;
+    IS->IF |= SERIAL;
+}
+void Serial::update(){
+    if (link) exchange();
+    if (transfer && scheduler->now >= doneAt){
+        // the peer answers as soon as it reaches the transfer, wait for it
+        LinkMessage message;
+        while (link && !replied && link->connected()){
+            if (link->receive(message, true)) handle(message);
+            answer();
+        }
+        complete(replied ? reply : 0xFF);
+    }
+    reschedule();
+}
+void Serial::reschedule(){
+    if (!scheduler) return;
+    uint64_t next = UINT64_MAX;
+    if (link && link->connected()) next = (scheduler->now / LINK_POLL + 1) * LINK_POLL;
+    if (transfer) next = std::min(next, doneAt);
+    if (next == UINT64_MAX) scheduler->cancel(EVENT_SERIAL);
+    else scheduler->schedule(EVENT_SERIAL, next);
+}
+
+bool Serial::write(uint16_t addr, uint8_t data){
+    switch (addr) {
+        case(0xFF01): // SB
+            SB = data;
+            return true;
+        case(0xFF02): // SC
+            SC = data;
+            if ((SC & 0x81) == 0x81){
+                // 8192 Hz, or 262144 Hz with the CGB fast clock bit
+                int bit = (SC & 0x02) ? 16 : 512;
+                transfer = true;
+                replied = false;
+                doneAt = scheduler->now + 8 * bit;
+                if (link) link->send({scheduler->now, LINK_DATA, SB});
+            }else transfer = false;
+            reschedule();
+            return true;
+    }
+    return false;
+}
+bool Serial::read(uint16_t addr, uint8_t& data){
+    switch (addr) {
+        case(0xFF01): // SB
+            data = SB;
+            return true;
+        case(0xFF02): // SC
+            data = SC | 0x7C;
+            return true;
+    }
+    return false;
+}
+struct SerialSection{
+    uint64_t doneAt;
+    uint8_t SB;
+    uint8_t SC;
+    uint8_t transfer;
+    uint8_t replied;
+    uint8_t reply;
+    uint8_t reserved[3];
+};
+static_assert(sizeof(SerialSection) == 16, "no padding in sections");
+void Serial::saveState(StateWriter& state){
+    SerialSection section{doneAt, SB, SC, transfer, replied, reply, {}};
+    state.begin(STATE_ID('S', 'E', 'R', 'L'));
+    state.put(section);
+    state.end();
+}
+bool Serial::loadState(StateReader& state){
+    SerialSection section;
+    if (!state.begin(STATE_ID('S', 'E', 'R', 'L')) || !state.get(section)) return false;
+    doneAt = section.doneAt;
+    SB = section.SB;
+    SC = section.SC;
+    transfer = section.transfer;
+    replied = section.replied;
+    reply = section.reply;
+    clocked.clear();
+    return true;
+}
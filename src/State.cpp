@@ -0,0 +1,68 @@
+#include <cstring>
+
+#include "../include/State.hpp"
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "save states are copied as they are in memory, which has to be little-endian"
+#endif
+
+StateWriter::StateWriter(uint8_t* buffer, size_t size) : data(buffer), capacity(size)
+{ }
+void StateWriter::begin(uint32_t id){
+    section = used;
+    StateSection header{id, 0};
+    put(header);
+    if (!data) sections.push_back(header);
+}
+void StateWriter::put(const void* source, size_t size){
+    if (data && used + size <= capacity) memcpy(data + used, source, size);
+    used += size;
+}
+void StateWriter::end(){
+    uint32_t size = used - section - sizeof(StateSection);
+    if (!data) sections.back().size = size;
+    if (!data || used > capacity) return;
+    memcpy(data + section + offsetof(StateSection, size), &size, sizeof(size));
+}
+
+StateReader::StateReader(const uint8_t* buffer, size_t size) : data(buffer), length(size)
+{ }
+bool StateReader::header(StateHeader& header){
+    if (length < sizeof(StateHeader)) return false;
+    memcpy(&header, data, sizeof(StateHeader));
+    return header.magic == STATE_MAGIC && header.version == STATE_VERSION
+        && header.size == length;
+}
+bool StateReader::begin(uint32_t id){
+    size_t at = sizeof(StateHeader);
+    StateSection section;
+    while (at + sizeof(StateSection) <= length){
+        memcpy(&section, data + at, sizeof(StateSection));
+        at += sizeof(StateSection);
+        if (section.size > length - at) return false;
+        if (section.id == id){
+            position = at;
+            sectionEnd = at + section.size;
+            return true;
+        }
+        at += section.size;
+    }
+    return false;
+}
+bool StateReader::get(void* target, size_t size){
+    if (size > sectionEnd - position) return false;
+    memcpy(target, data + position, size);
+    position += size;
+    return true;
+}
+bool StateReader::skip(size_t size){
+    if (size > sectionEnd - position) return false;
+    position += size;
+    return true;
+}
+bool StateReader::matches(const std::vector<StateSection>& layout){
+    for (const StateSection& section : layout){
+        if (!begin(section.id) || sectionEnd - position != section.size) return false;
+    }
+    return true;
+}
@@ -0,0 +1,66 @@
+#include <algorithm>
+#include <cmath>
+
+#include "../include/Stretch.hpp"
+
+// Periodic Hann windows at half overlap add up to exactly 1
+TimeStretch::TimeStretch() : overlap(STRETCH_GRAIN, 0.0f)
+{
+    for (int i = 0; i < STRETCH_GRAIN; i++)
+        window[i] = 0.5f - 0.5f * std::cos(2 * M_PI * i / STRETCH_GRAIN);
+}
+void TimeStretch::setSpeed(double value){
+    speed = std::clamp(value, STRETCH_MIN, STRETCH_MAX);
+}
+// Start near nominal whose first half correlates best with what follows
+// the last grain, on the left+right mix every fourth frame
+long TimeStretch::bestGrain(long nominal){
+    if (natural < 0) return nominal;
+    const int hop = STRETCH_GRAIN / 2;
+    long best = nominal;
+    float bestScore = -INFINITY;
+    for (long at = nominal - STRETCH_SEARCH; at <= nominal + STRETCH_SEARCH; at++){
+        const float* a = input.data() + natural * 2;
+        const float* b = input.data() + at * 2;
+        float score = 0;
+        for (int i = 0; i < hop; i += 4)
+            score += (a[i*2] + a[i*2 + 1]) * (b[i*2] + b[i*2 + 1]);
+        if (score > bestScore){
+            bestScore = score;
+            best = at;
+        }
+    }
+    return best;
+}
+void TimeStretch::process(const int16_t* samples, int count, std::vector<int16_t>& out){
+    input.insert(input.end(), samples, samples + count);
+    const int hop = STRETCH_GRAIN / 2;
+    long frames = input.size() / 2;
+    while (long(position) + STRETCH_SEARCH + STRETCH_GRAIN <= frames){
+        long start = bestGrain(long(position));
+        const float* grain = input.data() + start * 2;
+        for (int i = 0; i < STRETCH_GRAIN; i++){
+            for (int c = 0; c < 2; c++){
+                float value = grain[i*2 + c] * window[i];
+                if (i < hop){
+                    value += overlap[i*2 + c];
+                    out.push_back(int16_t(std::clamp(value, -32768.0f, 32767.0f)));
+                }else overlap[(i - hop)*2 + c] = value;
+            }
+        }
+        natural = start + hop;
+        position += hop * speed;
+    }
+    // keep what the next search can still reach
+    long used = std::min(long(position) - STRETCH_SEARCH, natural < 0 ? frames : natural);
+    used = std::clamp(used, 0L, frames);
+    input.erase(input.begin(), input.begin() + used * 2);
+    position -= used;
+    if (natural >= 0) natural -= used;
+}
+void TimeStretch::clear(){
+    input.clear();
+    std::fill(overlap.begin(), overlap.end(), 0.0f);
+    position = STRETCH_SEARCH;
+    natural = -1;
+}
@@ -0,0 +1,57 @@
+#include "../include/ThreadPool.hpp"
+
+ThreadPool::ThreadPool(int threads){
+    if (threads <= 0) threads = std::thread::hardware_concurrency();
+    if (threads <= 0) threads = 1;
+    for (int i = 1; i < threads; i++){
+        workers.emplace_back(&ThreadPool::work, this);
+    }
+}
+ThreadPool::~ThreadPool(){
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stop = true;
+    }
+    wake.notify_all();
+    for (auto& worker : workers) worker.join();
+}
+int ThreadPool::size(){
+    return workers.size() + 1;
+}
+void ThreadPool::work(){
+    std::unique_lock<std::mutex> guard(lock);
+    for (;;){
+        wake.wait(guard, [this] { return stop || next < count; });
+        if (stop) return;
+        int index = next++;
+        const std::function<void(int)>* task = job;
+        guard.unlock();
+        (*task)(index);
+        guard.lock();
+        if (++finished == count) done.notify_all();
+    }
+}
+void ThreadPool::run(int jobs, const std::function<void(int)>& task){
+    if (workers.empty() || jobs == 1){
+        for (int i = 0; i < jobs; i++) task(i);
+        return;
+    }
+    std::unique_lock<std::mutex> guard(lock);
+    job = &task;
+    count = jobs;
+    next = 0;
+    finished = 0;
+    wake.notify_all();
+
+    while (next < count){
+        int index = next++;
+        guard.unlock();
+        task(index);
+        guard.lock();
+        ++finished;
+    }
+    done.wait(guard, [this] { return finished == count; });
+    job = nullptr;
+    count = 0;
+    next = 0;
+}
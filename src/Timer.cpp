@@ -1,57 +1,144 @@
 #include "../include/Timer.hpp"
+#include "../include/APU.hpp"
+#include "../include/Scheduler.hpp"
 
+// TIMA period for every TAC clock select, it ticks when the counter bit
+// at half the period falls
 static const uint16_t frequency[4] = {1024, 16, 64, 256};
+// DIV bit clocking the APU frame sequencer at 512 Hz. Time reaching the
+// timer is always in single speed cycles (the CPU runs the extra double
+// speed instruction uncounted), so this stays bit 12 in double speed too.
+#define SEQUENCER_BIT 0x1000
 
-void Timer::step(int time){
-    self.internalDIV += time;
-    self.DIV = self.internalDIV >> 8;
-
-    if(self.TAC & 4){
-        self.internalTIMA += time;
-        int threshold = frequency[self.TAC & 3];
-        while (self.internalTIMA >= threshold) {
-            self.internalTIMA -= threshold;
-            self.TIMA++;
-            if (self.TIMA == 0) {
-                self.TIMA = self.TMA;
-                IS.IF |= TIMER;
-            }
-        }
+void Timer::setAPU(APU* master){
+    apu = master;
+}
+void Timer::setInterrupts(InterruptState* master){
+    IS = master;
+}
+void Timer::setScheduler(Scheduler* master){
+    scheduler = master;
+    self.divBase = scheduler->now;
+    self.timaAt = 0;
+    scheduleSequencer();
+    scheduleOverflow();
+}
+// Cycles since DIV was last reset, the low 16 bits are the real counter
+uint64_t Timer::counter(){
+    return scheduler->now - self.divBase;
+}
+// Every (256 - TMA) ticks after the first overflow wrap again
+void Timer::tick(uint64_t ticks){
+    if (ticks < uint64_t(256 - self.TIMA)){
+        self.TIMA += ticks;
+        return;
     }
+    ticks -= 256 - self.TIMA;
+    self.TIMA = self.TMA + ticks % (256 - self.TMA);
+    IS->IF |= TIMER;
+}
+void Timer::sync(){
+    uint64_t now = counter();
+    if (self.TAC & 4){
+        uint16_t period = frequency[self.TAC & 3];
+        tick(now / period - self.timaAt / period);
+    }
+    self.timaAt = now;
+    scheduleOverflow();
+}
+// Edges left until TIMA wraps, the last one lands on a period boundary
+void Timer::scheduleOverflow(){
+    if (!(self.TAC & 4)){
+        scheduler->cancel(EVENT_TIMER);
+        return;
+    }
+    uint16_t period = frequency[self.TAC & 3];
+    uint64_t edge = (self.timaAt / period + (256 - self.TIMA)) * period;
+    scheduler->schedule(EVENT_TIMER, self.divBase + edge);
+}
+// the sequencer steps when bit 12 falls, i.e. a carry into bit 13
+void Timer::scheduleSequencer(){
+    if (!apu || !apu->getSink()){
+        scheduler->cancel(EVENT_SEQUENCER);
+        return;
+    }
+    uint64_t edge = (counter() / (SEQUENCER_BIT << 1) + 1) * (SEQUENCER_BIT << 1);
+    scheduler->schedule(EVENT_SEQUENCER, self.divBase + edge);
+}
+uint32_t Timer::sequencerEdges(){
+    return counter() / (SEQUENCER_BIT << 1);
+}
+// The edge is passed by now, it was the last carry into bit 13
+void Timer::sequencerEdge(){
+    uint64_t edge = counter() / (SEQUENCER_BIT << 1) * (SEQUENCER_BIT << 1);
+    if (apu) apu->sequencerTick(self.divBase + edge);
+    scheduleSequencer();
 }
 
 bool Timer::write(uint16_t addr, uint8_t data){
+    if (addr < 0xFF04 || addr > 0xFF07) return false;
+    sync();
+    uint64_t now = self.timaAt;
+    // TIMA sees the AND of the enable bit and the selected counter bit,
+    // so a write that drops it from 1 to 0 is an extra tick
+    bool signal = (self.TAC & 4) && (now & (frequency[self.TAC & 3] >> 1));
     switch (addr) {
         case(0xFF04): // DIV
-            self.DIV = 0;
-            self.internalDIV = 0;
-            return true;
+            // resetting DIV with the bit set is a falling edge too
+            if (apu){
+                apu->divReset(now & SEQUENCER_BIT);
+                if (now & SEQUENCER_BIT) apu->sequencerTick(scheduler->now);
+            }
+            if (signal) tick(1);
+            self.divBase = scheduler->now;
+            self.timaAt = 0;
+            scheduleSequencer();
+            break;
         case(0xFF05): // TIMA
             self.TIMA = data;
-            return true;
+            break;
         case(0xFF06): // TMA
             self.TMA = data;
-            return true;
+            break;
         case(0xFF07): // TAC
             self.TAC = data & 7;
-            return true;
+            if (signal && !((self.TAC & 4) && (now & (frequency[self.TAC & 3] >> 1)))) tick(1);
+            break;
     }
-    return false;
+    scheduleOverflow();
+    return true;
 }
 bool Timer::read(uint16_t addr, uint8_t& data){
+    if (addr < 0xFF04 || addr > 0xFF07) return false;
     switch (addr) {
         case(0xFF04): // DIV
-            data = self.DIV;
+            data = counter() >> 8;
             return true;
         case(0xFF05): // TIMA
+            sync();
             data = self.TIMA;
             return true;
         case(0xFF06): // TMA
             data = self.TMA;
             return true;
-        case(0xFF07): // TAC
-            data = self.TAC;
-            return true;
     }
-    return false;
-}
\ No newline at end of file
+    data = self.TAC;
+    return true;
+}
+void Timer::saveState(StateWriter& state){
+    state.begin(STATE_ID('T', 'I', 'M', 'R'));
+    state.put(self);
+    state.end();
+}
+bool Timer::checkState(StateReader& state, uint64_t now){
+    TimerState saved;
+    if (!state.begin(STATE_ID('T', 'I', 'M', 'R')) || !state.get(saved)) return false;
+    return saved.divBase <= now && saved.timaAt <= now - saved.divBase && saved.TAC <= 7;
+}
+bool Timer::loadState(StateReader& state){
+    if (!state.begin(STATE_ID('T', 'I', 'M', 'R')) || !state.get(self)) return false;
+    // both events follow from the counters
+    scheduleSequencer();
+    scheduleOverflow();
+    return true;
+}
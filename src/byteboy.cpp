@@ -0,0 +1,133 @@
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include "../include/byteboy.h"
+#include "../include/GameBoy.hpp"
+#include "../include/Headless.hpp"
+
+struct byteboy{
+    Framebuffer screen;
+    RomImage* image{nullptr};
+    GameBoy* GB{nullptr};
+    SampleBuffer samples;
+    size_t played{0};
+    int rate{0};
+};
+
+// A fresh machine for every cartridge, the image stays with the handle
+static int start(byteboy* gb, RomImage* image){
+    delete gb->GB;
+    delete gb->image;
+    gb->screen.joypad.setInterrupts(nullptr);
+    gb->GB = nullptr;
+    gb->image = image;
+    gb->samples.samples.clear();
+    gb->played = 0;
+    if (!image) return 0;
+
+    gb->GB = new GameBoy(gb->screen);
+    GameBoy& GB = *gb->GB;
+    GB.MEM.verbose = false;
+    GB.MEM.saveFile = false;
+    if (!GB.MEM.load(*image)){
+        start(gb, nullptr);
+        return 0;
+    }
+    GB.GC.hashFrames = true;
+    if (gb->rate > 0){
+        GB.AP.setSink(&gb->samples);
+        GB.AP.setOutput(gb->rate, AUDIO_BLOCK);
+    }
+    GB.init();
+    return 1;
+}
+
+extern "C" {
+
+byteboy* byteboy_create(void){
+    return new byteboy;
+}
+void byteboy_destroy(byteboy* gb){
+    if (!gb) return;
+    start(gb, nullptr);
+    delete gb;
+}
+
+int byteboy_load_rom_file(byteboy* gb, const char* path){
+    RomImage* image = new RomImage;
+    if (!image->readFromFile(path)){
+        delete image;
+        image = nullptr;
+    }
+    return start(gb, image);
+}
+int byteboy_load_rom_memory(byteboy* gb, const void* data, size_t size){
+    RomImage* image = new RomImage;
+    if (!image->readFromMemory(static_cast<const uint8_t*>(data), size)){
+        delete image;
+        image = nullptr;
+    }
+    return start(gb, image);
+}
+
+void byteboy_run_frame(byteboy* gb){
+    if (gb->GB) gb->GB->runFrame();
+}
+void byteboy_run_cycles(byteboy* gb, uint64_t cycles){
+    if (!gb->GB) return;
+    Scheduler& scheduler = gb->GB->scheduler;
+    uint64_t until = scheduler.now + cycles;
+    while (scheduler.now < until) gb->GB->step();
+}
+uint64_t byteboy_cycles(const byteboy* gb){
+    return gb->GB ? gb->GB->scheduler.now : 0;
+}
+
+void byteboy_set_input(byteboy* gb, uint8_t buttons){
+    Joypad& joypad = gb->screen.joypad;
+    uint8_t low = ~buttons & 0xF;
+    uint8_t high = (~buttons >> 4) & 0xF;
+    if (joypad.buttons == low && joypad.directions == high) return;
+    joypad.buttons = low;
+    joypad.directions = high;
+    joypad.update();
+}
+
+const uint32_t* byteboy_framebuffer(const byteboy* gb){
+    return gb->screen.pixels;
+}
+uint64_t byteboy_frame_hash(const byteboy* gb){
+    return gb->GB ? gb->GB->GC.frameHash : 0;
+}
+
+void byteboy_set_audio(byteboy* gb, int rate){
+    gb->rate = std::max(rate, 0);
+}
+size_t byteboy_audio_available(const byteboy* gb){
+    return (gb->samples.samples.size() - gb->played) / 2;
+}
+size_t byteboy_audio_samples(byteboy* gb, int16_t* out, size_t frames){
+    std::vector<int16_t>& samples = gb->samples.samples;
+    size_t count = std::min(frames, byteboy_audio_available(gb));
+    std::memcpy(out, samples.data() + gb->played, count * 2 * sizeof(int16_t));
+    gb->played += count * 2;
+    // drop what was read once it is most of the buffer
+    if (gb->played * 2 >= samples.size()){
+        samples.erase(samples.begin(), samples.begin() + gb->played);
+        gb->played = 0;
+    }
+    return count;
+}
+
+size_t byteboy_state_size(byteboy* gb){
+    return gb->GB ? gb->GB->stateSize() : 0;
+}
+int byteboy_save_state(byteboy* gb, void* buffer, size_t size){
+    return gb->GB && gb->GB->saveState(static_cast<uint8_t*>(buffer), size);
+}
+int byteboy_load_state(byteboy* gb, const void* buffer, size_t size){
+    return gb->GB && gb->GB->loadState(static_cast<const uint8_t*>(buffer), size);
+}
+
+}
@@ -1,56 +1,177 @@
-#include "../include/PPU.hpp"
-#include "../include/CPU.hpp"
-#include "../include/APU.hpp"
-#include "../include/MEM.hpp"
-#include "../include/Display.hpp"
-#include "../include/Timer.hpp"
-#include "../include/types.hpp"
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
 
-class GameBoy{
-public:
-    InterruptState bus;
-    Window context;
-    MemoryMaster MEM;
-    CPU GB;
-    PPU GC;
-    APU AP;
-    Timer timer;
+#include "../include/GameBoy.hpp"
+#include "../include/Display.hpp"
+#include "../include/Audio.hpp"
+#include "../include/Headless.hpp"
+#include "../include/HeadlessCli.hpp"
+#include "../include/Rewind.hpp"
+#include "../include/RunAhead.hpp"
 
-    GameBoy() : context(640,576,"gbc.emu"), GB(MEM),
-    GC(MEM, context)
-    {
-        MEM.setTimer(&timer);
-        MEM.setJoypad(&context.joypad);
-        MEM.setPPU(&GC);
-        MEM.setAPU(&AP);
-    }
-    
-    void start(){
-        int time;
-        GB.init();
-        context.joypad.update();
-        while (context.isOpen()) {
-            time = GB.step();
-            GC.step(time);
-            timer.step(time);
-        }
+static void waitUntilDropFile(Window& context, MemoryMaster& MEM){
+    while (!context.poolFile(MEM) && context.isOpen()) {
+        context.show();
+    }
+}
+int main(int args, char *argv[]){
+    if (args > 1 && !strcmp(argv[1], "--headless")){
+        return runHeadless(args - 1, argv + 1);
+    }
+    const char* rom = nullptr;
+    ColorMode colors = COLOR_RAW;
+    ScaleFilter filter = FILTER_NEAREST;
+    int factor = 2;
+    int renderThreads = -1;
+    SyncMode sync = SYNC_VIDEO;
+    AudioConfig audioConfig;
+    AudioBackend backend = AUDIO_SDL;
+    const char* audioOut = nullptr;
+    const char* linkListen = nullptr;
+    const char* linkConnect = nullptr;
+    bool rewind = false;
+    int rewindInterval = 2;
+    int rewindSize = 64;
+    int runAhead = 0;
+    bool runAheadSecond = false;
+    double speed = 1.0;
+    double turboSpeed = 0;
+    for (int i = 1; i < args; i++){
+        if (!strcmp(argv[i], "--colors") && i + 1 < args){
+            if (!parseColorMode(argv[++i], colors)){
+                std::cerr << "unknown color mode " << argv[i] << "\n";
+                return 1;
+            }
+        }else if (!strcmp(argv[i], "--filter") && i + 1 < args){
+            if (!parseScaleFilter(argv[++i], filter)){
+                std::cerr << "unknown filter " << argv[i] << "\n";
+                return 1;
+            }
+        }else if (!strcmp(argv[i], "--scale") && i + 1 < args){
+            factor = atoi(argv[++i]);
+        }else if (!strcmp(argv[i], "--render-threads") && i + 1 < args){
+            renderThreads = atoi(argv[++i]);
+        }else if (!strcmp(argv[i], "--sync") && i + 1 < args){
+            i++;
+            if (!strcmp(argv[i], "audio")) sync = SYNC_AUDIO;
+            else if (!strcmp(argv[i], "video")) sync = SYNC_VIDEO;
+            else {
+                std::cerr << "unknown sync mode " << argv[i] << "\n";
+                return 1;
+            }
+        }else if (!strcmp(argv[i], "--audio-rate") && i + 1 < args){
+            audioConfig.sampleRate = atoi(argv[++i]);
+        }else if (!strcmp(argv[i], "--audio-buffer") && i + 1 < args){
+            audioConfig.bufferSize = atoi(argv[++i]);
+        }else if (!strcmp(argv[i], "--audio-latency") && i + 1 < args){
+            audioConfig.latency = atoi(argv[++i]);
+        }else if (!strcmp(argv[i], "--audio-queue")){
+            audioConfig.queue = true;
+        }else if (!strcmp(argv[i], "--audio-backend") && i + 1 < args){
+            if (!parseAudioBackend(argv[++i], backend)){
+                std::cerr << "unknown audio backend " << argv[i] << "\n";
+                return 1;
+            }
+        }else if (!strcmp(argv[i], "--audio-out") && i + 1 < args){
+            audioOut = argv[++i];
+            backend = AUDIO_FILE;
+        }else if (!strcmp(argv[i], "--link-listen") && i + 1 < args){
+            linkListen = argv[++i];
+        }else if (!strcmp(argv[i], "--link-connect") && i + 1 < args){
+            linkConnect = argv[++i];
+        }else if (!strcmp(argv[i], "--rewind")){
+            rewind = true;
+        }else if (!strcmp(argv[i], "--rewind-interval") && i + 1 < args){
+            rewindInterval = atoi(argv[++i]);
+        }else if (!strcmp(argv[i], "--rewind-size") && i + 1 < args){
+            rewindSize = atoi(argv[++i]);
+        }else if (!strcmp(argv[i], "--run-ahead") && i + 1 < args){
+            runAhead = atoi(argv[++i]);
+        }else if (!strcmp(argv[i], "--run-ahead-second")){
+            runAheadSecond = true;
+        }else if (!strcmp(argv[i], "--speed") && i + 1 < args){
+            speed = atof(argv[++i]);
+        }else if (!strcmp(argv[i], "--turbo-speed") && i + 1 < args){
+            turboSpeed = atof(argv[++i]);
+        }else if (!strcmp(argv[i], "--speed-audio") && i + 1 < args){
+            i++;
+            if (!strcmp(argv[i], "stretch")) audioConfig.stretch = true;
+            else if (!strcmp(argv[i], "mute")) audioConfig.stretch = false;
+            else {
+                std::cerr << "unknown speed audio mode " << argv[i] << "\n";
+                return 1;
+            }
+        }else rom = argv[i];
     }
-    void waitUntilDropFile(){
-        while (!context.poolFile(MEM) && context.isOpen()) {
-            context.show();
+    Window context(640,576,"gbc.emu");
+    GameBoy GB(context);
+    AudioDevice* audio = nullptr;
+    AudioFile file;
+    if (backend == AUDIO_SDL){
+        audio = new AudioDevice(GB.AP, sync, audioConfig);
+    }else if (backend == AUDIO_FILE){
+        if (!audioOut){
+            std::cerr << "the file backend needs --audio-out\n";
+            return 1;
         }
+        if (!file.open(audioOut, audioConfig.sampleRate)) return 1;
+        GB.AP.setOutput(audioConfig.sampleRate, AUDIO_BLOCK);
+        GB.AP.setSink(&file);
     }
-};
-int main(int args, char *argv[]){
-    GameBoy GB;
+    // only a sound card can pace emulation
+    if (!audio) sync = SYNC_VIDEO;
+    GB.GC.setColorMode(colors);
+    if (filter != FILTER_NEAREST) context.setFilter(filter, factor);
+    context.setSpeed(speed, turboSpeed);
+    context.setAudio(audio);
+    GB.GC.setParallel(renderThreads);
+    if (rewind) GB.rewind = new Rewind(GB, rewindInterval, size_t(rewindSize) << 20);
 
-    if (args < 2){
-        GB.waitUntilDropFile();
-        if (GB.context.isOpen()) GB.start();
-    }else{
-        if (GB.MEM.readFromFile(argv[1])){
-            GB.start();
-        }
+    bool loaded;
+    if (!rom){
+        waitUntilDropFile(context, GB.MEM);
+        loaded = context.isOpen();
+    }else loaded = GB.MEM.readFromFile(rom);
+    SocketLink link;
+    if (loaded && linkListen) loaded = link.listen(linkListen);
+    if (loaded && linkConnect) loaded = link.connect(linkConnect);
+    if (link.connected()) GB.serial.setLink(&link);
+    // frames run ahead would send bytes the other side cannot take back
+    if (loaded && runAhead > 0 && link.connected()){
+        std::cerr << "run-ahead does not work over a link cable, turned off\n";
+        runAhead = 0;
+    }
+    if (loaded && runAhead > 0) GB.runAhead = new RunAhead(GB, runAhead, runAheadSecond);
+    if (loaded){
+        context.setSync(sync);
+        GB.start();
+    }
+    if (loaded && audio){
+        std::cout << "audio: fill " << audio->fill() << "/" << audio->target()
+                  << " samples, ratio " << audio->ratio()
+                  << ", " << audio->underrunCount() << " underruns, "
+                  << audio->overrunCount() << " frames dropped\n";
+    }
+    if (loaded && GB.rewind){
+        RewindStats& stats = GB.rewind->stats;
+        size_t snapshots = GB.rewind->size();
+        std::cout << "rewind: " << snapshots << " snapshots, "
+                  << GB.rewind->bytes() / 1048576.0 << " MB, capture "
+                  << stats.captureSeconds * 1e6 / (stats.captures ? stats.captures : 1) << " us, compress "
+                  << stats.compressSeconds * 1e6 / (stats.captures ? stats.captures : 1) << " us, step "
+                  << stats.stepSeconds * 1e6 / (stats.steps ? stats.steps : 1) << " us\n";
+    }
+    if (GB.runAhead && GB.runAhead->stats.frames){
+        RunAheadStats& stats = GB.runAhead->stats;
+        double frames = stats.frames;
+        std::cout << "run-ahead: " << runAhead << " frames, per frame " << stats.frameSeconds * 1e6 / frames
+                  << " us real, " << (stats.saveSeconds + stats.aheadSeconds + stats.loadSeconds) * 1e6 / frames
+                  << " us ahead (save " << stats.saveSeconds * 1e6 / frames
+                  << ", load " << stats.loadSeconds * 1e6 / frames << ")\n";
     }
+    delete GB.runAhead;
+    delete GB.rewind;
+    delete audio;
     return 0;
-}
\ No newline at end of file
+}
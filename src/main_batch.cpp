@@ -0,0 +1,5 @@
+#include "../include/Batch.hpp"
+
+int main(int args, char *argv[]){
+    return runBatch(args, argv);
+}
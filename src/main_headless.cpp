@@ -0,0 +1,5 @@
+#include "../include/HeadlessCli.hpp"
+
+int main(int args, char *argv[]){
+    return runHeadless(args, argv);
+}